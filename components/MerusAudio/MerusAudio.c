@@ -15,6 +15,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "esp_log.h"
 #include "driver/i2c.h"
 
@@ -171,3 +172,24 @@ void init_ma120(uint8_t vol)
 
     printf("Init done\n");
 }
+
+/*
+ * Master volume in 1/4 dB steps below 0 dB. The audio processor ramps to
+ * the new level, no samples need scaling.
+ */
+#define MA_VOL_DB_MASTER_0DB 0x18
+
+void ma120_set_attenuation(uint16_t quarter_db)
+{
+    uint16_t steps = MA_VOL_DB_MASTER_0DB * 4 + quarter_db;
+    if (steps > 0xff * 4 + 3) steps = 0xff * 4 + 3;
+
+    ma_write_byte(MA_vol_db_master__a, steps >> 2);
+    set_MA_vol_lsb_master(steps & 3);
+}
+
+/* soft mute in the audio processor, ramped like a volume change */
+void ma120_set_mute(bool mute)
+{
+    set_MA_audio_proc_mute(mute ? 1 : 0);
+}
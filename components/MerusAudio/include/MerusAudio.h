@@ -2,6 +2,7 @@
 #ifndef _MERUSAUDIO_H_
 #define _MERUSAUDIO_H_
 
+#include <stdbool.h>
 
 void i2c_master_init();
 
@@ -14,6 +15,9 @@ esp_err_t ma_read(uint8_t address, uint8_t *rbuf, uint8_t n);
 
 void init_ma120(uint8_t vol);
 
+void ma120_set_attenuation(uint16_t quarter_db);
+void ma120_set_mute(bool mute);
+
 #endif /* _MERUSAUDIO_H_  */
 
 
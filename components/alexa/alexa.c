@@ -79,6 +79,9 @@ static char *uri_events = ALEXA_ENDPOINT "/v20160207/events";
 #define BEARER "Bearer "
 #define NL "\r\n"
 
+/* HTTP/2 stream window, the most a response can have in flight to us */
+#define STREAM_WINDOW_SIZE (16 * 1024)
+
 /* embedded file */
 extern uint8_t file_start[] asm("_binary_what_time_raw_start");
 extern uint8_t file_end[] asm("_binary_what_time_raw_end");
@@ -135,6 +138,8 @@ static int create_alexa_session(alexa_session_t **alexa_session_ptr)
     // init player
     alexa_session->player_config = calloc(1, sizeof(player_t));
     alexa_session->player_config->command = CMD_NONE;
+    // speech ducks the content streams and doesn't wait for them
+    alexa_session->player_config->source = RENDERER_SOURCE_DIALOG;
     alexa_session->player_config->decoder_status = UNINITIALIZED;
     alexa_session->player_config->decoder_command = CMD_NONE;
     alexa_session->player_config->buffer_pref = BUF_PREF_FAST;
@@ -142,6 +147,7 @@ static int create_alexa_session(alexa_session_t **alexa_session_ptr)
             sizeof(media_stream_t));
     alexa_session->player_config->media_stream->eof = true;
     alexa_session->player_config->media_stream->content_type = MIME_UNKNOWN;
+    alexa_session->player_config->fifo = fifo_create(PLAYER_FIFO_SIZE, FIFO_BACKING_SPIRAM);
 
     // init streams
     alexa_session->stream_directives = calloc(1, sizeof(alexa_stream_t));
@@ -255,6 +261,12 @@ int on_data_recv_callback(nghttp2_session *session, uint8_t flags,
 {
     alexa_stream_t *stream = nghttp2_session_get_stream_user_data(session,
             stream_id);
+    size_t chunk_len = len;
+
+    // make room before anything new arrives in the backlog
+    stream_handler_events_claim_audio(stream, stream_id);
+    stream_handler_events_drain_audio(stream);
+    size_t backlog = stream_handler_events_audio_backlog(stream);
 
     // listen to what the goddess has to say
     if (stream->stream_type == STREAM_DIRECTIVES
@@ -292,6 +304,13 @@ int on_data_recv_callback(nghttp2_session *session, uint8_t flags,
         multipart_parser_execute(stream->m_parser, (char*) data, len);
     }
 
+    // Window updates are manual. The connection window goes back right away
+    // so the other streams keep flowing, the stream window only for what
+    // didn't end up in the backlog.
+    size_t deferred = stream_handler_events_audio_backlog(stream) - backlog;
+    nghttp2_session_consume_connection(session, chunk_len);
+    nghttp2_session_consume_stream(session, stream_id, chunk_len - deferred);
+
     return 0;
 }
 
@@ -426,15 +445,26 @@ int open_downchannel(alexa_session_t *alexa_session)
     nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
             stream_close_callback);
 
+    // the data callback returns the flow control window itself
+    nghttp2_option *option;
+    nghttp2_option_new(&option);
+    nghttp2_option_set_no_auto_window_update(option, 1);
+
     ret = nghttp_new_session(&http2_session, uri_directives, "GET",
             &alexa_session->stream_directives->stream_id, hdrs, 1,
-            NULL, callbacks,
+            NULL, callbacks, option,
             alexa_session->stream_directives, alexa_session);
+    nghttp2_option_del(option);
     if (ret != 0) {
         free_http2_session_data(http2_session, ret);
         return ret;
     }
 
+    // bounds the audio backlog of a stream
+    nghttp2_settings_entry iv[1] = { { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE,
+            STREAM_WINDOW_SIZE } };
+    nghttp2_submit_settings(http2_session->h2_session, NGHTTP2_FLAG_NONE, iv, 1);
+
     free(auth_header);
 
     alexa_session->stream_directives->http2_session = http2_session;
@@ -548,6 +578,17 @@ asio_result_t on_downchan_connected_cb(asio_task_t *task, void *arg, void *user_
     return ASIO_OK;
 }
 
+/* feed audio the player had no room for once it has */
+asio_result_t on_audio_backlog_cb(asio_task_t *task, void *arg, void *user_data)
+{
+    alexa_session_t *alexa_session = user_data;
+
+    stream_handler_events_drain_audio(alexa_session->stream_directives);
+    stream_handler_events_drain_audio(alexa_session->stream_events);
+
+    return ASIO_OK;
+}
+
 /* start auth token refresh */
 asio_result_t on_wifi_connected_cb(asio_task_t *task, void *arg, void *user_data)
 {
@@ -597,6 +638,9 @@ int alexa_init()
     /* send initial state when downchannel is connected */
     asio_new_generic_task("send_initial_state", alexa_session->registry, on_downchan_connected_cb, alexa_session->event_group, alexa_session);
 
+    /* move backlogged audio into the player */
+    asio_new_generic_task("audio_backlog", alexa_session->registry, on_audio_backlog_cb, NULL, alexa_session);
+
     // run event loop
     while(1) {
         asio_registry_poll(alexa_session->registry);
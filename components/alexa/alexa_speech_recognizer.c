@@ -25,6 +25,7 @@
 #include "multipart_producer.h"
 #include "ui.h"
 #include "alexa_speech_recognizer.h"
+#include "play_queue.h"
 
 #include "include/alexa_events_js.h"
 
@@ -57,7 +58,9 @@ ssize_t send_speech_read_callback(nghttp2_session *session, int32_t stream_id,
         return NGHTTP2_ERR_PAUSE;
     }
 
-    buffer_t *buffer = buf_wrap(buf, buf_length);
+    // wrapper lives on the stack, called for every chunk
+    buffer_t wrapper;
+    buffer_t *buffer = buf_init(&wrapper, buf, buf_length);
 
     switch (alexa_stream->next_action) {
         case META_HEADERS:
@@ -115,7 +118,7 @@ ssize_t send_speech_read_callback(nghttp2_session *session, int32_t stream_id,
             bytes_written = samples_read * (I2S_BITS_PER_SAMPLE_16BIT / 8);
 
             // local echo
-            render_samples((char*) buf, bytes_written, &buf_desc);
+            render_source_samples(RENDERER_SOURCE_DIALOG, (char*) buf, bytes_written, &buf_desc);
 
             rounds++;
             if(rounds > 1) {
@@ -130,7 +133,8 @@ ssize_t send_speech_read_callback(nghttp2_session *session, int32_t stream_id,
 
         case DONE:
             audio_recorder_stop();
-            renderer_stop();
+            // the echo runs dry by itself, stopping would drop the held content
+            play_queue_resume();
             ESP_LOGE(TAG, "DONE");
             multipart_end(buffer);
             *data_flags |= NGHTTP2_DATA_FLAG_EOF;
@@ -148,8 +152,6 @@ ssize_t send_speech_read_callback(nghttp2_session *session, int32_t stream_id,
         printf("%.*s\n", bytes_written, buf);
     }
 
-    //buf_destroy(buffer);
-    free(buffer);
 
     return bytes_written;
 }
@@ -158,6 +160,8 @@ ssize_t send_speech_read_callback(nghttp2_session *session, int32_t stream_id,
 void speech_recognizer_start_capture(alexa_session_t *alexa_session)
 {
     state = SPEECH_RECOGNIZING;
+    // content is held rather than heard over the user, it goes on from there
+    play_queue_pause();
     renderer_start();
     audio_recorder_start();
 
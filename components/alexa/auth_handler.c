@@ -106,6 +106,7 @@ void auth_token_refresh(alexa_session_t *alexa_session)
                     NULL, 0,
                     NULL,
                     callbacks,
+                    NULL,
                     buffer,
                     alexa_session);
 
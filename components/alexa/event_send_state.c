@@ -32,7 +32,9 @@ ssize_t send_state_read_cb(nghttp2_session *session, int32_t stream_id,
 {
     alexa_stream_t *alexa_stream = data_source->ptr;
 
-    buffer_t *buffer = buf_wrap(buf, buf_length);
+    // wrapper lives on the stack, called for every chunk
+    buffer_t wrapper;
+    buffer_t *buffer = buf_init(&wrapper, buf, buf_length);
 
     begin_part_meta_data(buffer);
 
@@ -45,8 +47,6 @@ ssize_t send_state_read_cb(nghttp2_session *session, int32_t stream_id,
 
     ssize_t bytes_written = buf_data_total(buffer);
     printf("%.*s\n", bytes_written, buf);
-    //buf_destroy(buffer);
-    free(buffer);
 
     return bytes_written;
 }
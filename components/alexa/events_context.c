@@ -5,6 +5,7 @@
  *      Author: michaelboeckling
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -14,6 +15,9 @@
 
 #include "cJSON.h"
 
+#include "audio_renderer.h"
+#include "play_queue.h"
+
 /*
  {
     "header": {
@@ -68,9 +72,21 @@ cJSON* ctx_alerts_state()
     }
 }
 */
+static const char *play_activities[] = {
+    [PLAY_IDLE] = "IDLE",
+    [PLAY_PLAYING] = "PLAYING",
+    [PLAY_PAUSED] = "PAUSED",
+    [PLAY_STOPPED] = "STOPPED",
+    [PLAY_FINISHED] = "FINISHED"
+};
+
 cJSON* ctx_playback_state()
 {
     cJSON *root, *header, *payload;
+    char *token;
+    uint32_t offset_ms;
+
+    play_activity_t activity = play_queue_get_state(&token, &offset_ms);
 
     root = cJSON_CreateObject();
 
@@ -79,10 +95,11 @@ cJSON* ctx_playback_state()
     cJSON_AddStringToObject(header, "name", "PlaybackState");
 
     cJSON_AddItemToObject(root, "payload", payload = cJSON_CreateObject());
-    cJSON_AddStringToObject(payload, "token", "");
-    cJSON_AddNumberToObject(payload, "offsetInMilliseconds", 0);
-    cJSON_AddStringToObject(payload, "playerActivity", "IDLE");
+    cJSON_AddStringToObject(payload, "token", token ? token : "");
+    cJSON_AddNumberToObject(payload, "offsetInMilliseconds", offset_ms);
+    cJSON_AddStringToObject(payload, "playerActivity", play_activities[activity]);
 
+    free(token);
     return root;
 }
 
@@ -109,8 +126,8 @@ cJSON* ctx_volume_state()
     cJSON_AddStringToObject(header, "name", "VolumeState");
 
     cJSON_AddItemToObject(root, "payload", payload = cJSON_CreateObject());
-    cJSON_AddNumberToObject(payload, "volume", 100);
-    cJSON_AddBoolToObject(payload, "muted", false);
+    cJSON_AddNumberToObject(payload, "volume", renderer_get_volume());
+    cJSON_AddBoolToObject(payload, "muted", renderer_get_mute());
 
     return root;
 }
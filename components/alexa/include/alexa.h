@@ -8,6 +8,8 @@
 #ifndef _INCLUDE_ALEXA_H_
 #define _INCLUDE_ALEXA_H_
 
+#include "common_buffer.h"
+
 #define ALEXA_ENDPOINT CONFIG_ALEXA_ENDPOINT
 #define ALEXA_LOCALE CONFIG_ALEXA_LOCALE
 
@@ -60,6 +62,12 @@ typedef struct
     uint8_t *file_pos;
     uint16_t msg_id;
     uint16_t dialog_req_id;
+    /* audio the player had no room for yet, the server gets the stream
+     * window for it back once it went into the FIFO */
+    buffer_t *audio_backlog;
+    int32_t backlog_stream_id;
+    /* the audio part ended, but not all of it is in the FIFO */
+    bool audio_eof_pending;
 } alexa_stream_t;
 
 
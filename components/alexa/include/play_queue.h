@@ -0,0 +1,64 @@
+/*
+ * play_queue.h
+ *
+ * Streams of AudioPlayer.Play directives, played one after the other. The
+ * next one is downloaded and buffered while the current one finishes, and
+ * its decoder starts right after the last frame of the current one.
+ *
+ *  Created on: 01.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef _INCLUDE_PLAY_QUEUE_H_
+#define _INCLUDE_PLAY_QUEUE_H_
+
+#include <inttypes.h>
+
+/* streams waiting behind the one that plays */
+#define PLAY_QUEUE_LEN 8
+
+/* playBehavior of a Play directive */
+typedef enum {
+    PLAY_REPLACE_ALL, PLAY_ENQUEUE, PLAY_REPLACE_ENQUEUED
+} play_behavior_t;
+
+/* CLEAR_ALL or CLEAR_ENQUEUED of a ClearQueue directive */
+typedef enum {
+    CLEAR_ALL, CLEAR_ENQUEUED
+} clear_behavior_t;
+
+/* playerActivity of the PlaybackState */
+typedef enum {
+    PLAY_IDLE, PLAY_PLAYING, PLAY_PAUSED, PLAY_STOPPED, PLAY_FINISHED
+} play_activity_t;
+
+/* REPLACE_ALL for anything it doesn't know */
+play_behavior_t play_behavior_from_string(const char *behavior);
+
+/**
+ * Plays url as behavior says. REPLACE_ALL stops what plays, the new
+ * stream starts once that has faded out. Returns -1 if the queue is full.
+ */
+int play_queue_play(const char *url, const char *token, play_behavior_t behavior);
+
+/* drops the waiting streams, CLEAR_ALL stops the current one as well */
+void play_queue_clear(clear_behavior_t behavior);
+
+/**
+ * Holds the stream that plays, its decoder, buffers and connection stay as
+ * they are. Nothing new starts until play_queue_resume(), a Play directive
+ * that replaces everything or a CLEAR_ALL.
+ */
+void play_queue_pause();
+
+/* plays on where play_queue_pause() stopped, without buffering again */
+void play_queue_resume();
+
+/**
+ * What plays, or played last. Stores the token of that stream in *token,
+ * to be freed by the caller, or NULL, and the time of it heard so far in
+ * *offset_ms.
+ */
+play_activity_t play_queue_get_state(char **token, uint32_t *offset_ms);
+
+#endif /* _INCLUDE_PLAY_QUEUE_H_ */
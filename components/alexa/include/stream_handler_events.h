@@ -10,4 +10,14 @@
 
 void stream_handler_events_init_multipart_parser(alexa_stream_t *alexa_stream, char *boundary_term);
 
+/* bytes of audio waiting for room in the player FIFO */
+size_t stream_handler_events_audio_backlog(alexa_stream_t *alexa_stream);
+
+/* move backlogged audio into the player FIFO, never blocks */
+void stream_handler_events_drain_audio(alexa_stream_t *alexa_stream);
+
+/* Data of stream_id is about to be parsed. Audio left over from a different
+ * stream is stale and dropped. */
+void stream_handler_events_claim_audio(alexa_stream_t *alexa_stream, int32_t stream_id);
+
 #endif /* _INCLUDE_STREAM_HANDLER_EVENTS_H_ */
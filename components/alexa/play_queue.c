@@ -0,0 +1,402 @@
+/*
+ * play_queue.c
+ *
+ * Two slots, each a web radio with its own player and FIFO, take turns.
+ * While one plays, the other one downloads the next stream until its FIFO
+ * is full and hands it to the decoder worker, which starts it as soon as
+ * the current stream is through. Only one download runs at a time.
+ *
+ *  Created on: 01.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "audio_player.h"
+#include "web_radio.h"
+#include "fifo.h"
+#include "play_queue.h"
+
+#define TAG "play_queue"
+
+#define PLAY_QUEUE_SLOTS 2
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef struct {
+    char *url;
+    char *token;
+} play_item_t;
+
+typedef struct {
+    web_radio_t radio;
+    player_t player;
+    media_stream_t media_stream;
+    play_item_t item;
+    /* the reader task is running */
+    bool fetching;
+    /* order the slots were started in, the oldest busy one plays */
+    uint32_t seq;
+    /* the stream was stopped rather than played to the end */
+    bool stopped;
+    /* position when the decoder was done, the tail was still to be heard */
+    uint32_t done_ms;
+} play_slot_t;
+
+static play_slot_t slots[PLAY_QUEUE_SLOTS];
+static bool slots_ready = false;
+
+static uint32_t next_seq = 0;
+
+static play_item_t pending[PLAY_QUEUE_LEN];
+static int pending_head = 0;
+static int pending_count = 0;
+
+static SemaphoreHandle_t queue_lock = NULL;
+
+/* play_queue_pause(), streams started meanwhile wait as well */
+static bool paused = false;
+
+play_behavior_t play_behavior_from_string(const char *behavior)
+{
+    if (behavior == NULL)
+        return PLAY_REPLACE_ALL;
+
+    if (strcmp(behavior, "ENQUEUE") == 0)
+        return PLAY_ENQUEUE;
+    if (strcmp(behavior, "REPLACE_ENQUEUED") == 0)
+        return PLAY_REPLACE_ENQUEUED;
+
+    return PLAY_REPLACE_ALL;
+}
+
+static void item_free(play_item_t *item)
+{
+    free(item->url);
+    free(item->token);
+    item->url = NULL;
+    item->token = NULL;
+}
+
+static void clear_pending()
+{
+    while (pending_count > 0) {
+        item_free(&pending[pending_head]);
+        pending_head = (pending_head + 1) % PLAY_QUEUE_LEN;
+        pending_count--;
+    }
+}
+
+/* neither downloading nor decoding */
+static bool slot_idle(play_slot_t *slot)
+{
+    return !slot->fetching && slot->player.decoder_status != RUNNING;
+}
+
+static void slot_abort(play_slot_t *slot)
+{
+    player_t *player = &slot->player;
+
+    // the reader gives up with its next piece of data
+    player->command = CMD_STOP;
+    slot->stopped = true;
+
+    if (player->decoder_status == RUNNING) {
+        audio_player_abort(player);
+    } else if (slot->fetching) {
+        // no decoder consumes this FIFO, so it may be reset from here. That
+        // makes room for the download blocked on writing to it.
+        fifo_reset(player->fifo);
+    }
+}
+
+/* stops the streams that were started after the current one */
+static void abort_enqueued()
+{
+    play_slot_t *current = NULL;
+
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        if (!slot_idle(&slots[i]) && (current == NULL || slots[i].seq < current->seq))
+            current = &slots[i];
+    }
+
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        if (&slots[i] != current && !slot_idle(&slots[i]))
+            slot_abort(&slots[i]);
+    }
+}
+
+static void abort_all()
+{
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        if (!slot_idle(&slots[i]))
+            slot_abort(&slots[i]);
+    }
+}
+
+/* starts the next stream on an idle slot, lock held */
+static void start_next()
+{
+    if (pending_count == 0)
+        return;
+
+    play_slot_t *slot = NULL;
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        // one download at a time, the next one starts when it is through
+        if (slots[i].fetching)
+            return;
+
+        if (slot == NULL && slot_idle(&slots[i]))
+            slot = &slots[i];
+    }
+
+    if (slot == NULL)
+        return;
+
+    item_free(&slot->item);
+    slot->item = pending[pending_head];
+    pending_head = (pending_head + 1) % PLAY_QUEUE_LEN;
+    pending_count--;
+
+    player_t *player = &slot->player;
+    player->command = CMD_NONE;
+    player->decoder_command = paused ? CMD_PAUSE : CMD_NONE;
+    player->decoder_status = UNINITIALIZED;
+    player->stream_id = 0;
+    slot->stopped = false;
+    slot->done_ms = 0;
+    slot->media_stream.eof = false;
+    slot->media_stream.content_type = MIME_UNKNOWN;
+
+    // leftovers of a stream that never got to the decoder
+    fifo_reset(player->fifo);
+
+    ESP_LOGI(TAG, "fetching %s, %d waiting", slot->item.url, pending_count);
+
+    slot->radio.url = slot->item.url;
+    slot->seq = next_seq++;
+    slot->fetching = true;
+    web_radio_start(&slot->radio);
+}
+
+/* reader task */
+static void on_fetch_finished(web_radio_t *radio)
+{
+    play_slot_t *slot = radio->user_data;
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    slot->fetching = false;
+    start_next();
+    xSemaphoreGive(queue_lock);
+}
+
+/* decoder worker */
+static void on_stream_done(player_t *player)
+{
+    play_slot_t *slot = player->user_data;
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    slot->done_ms = player_get_position_ms(player);
+    start_next();
+    xSemaphoreGive(queue_lock);
+}
+
+static int init_slots()
+{
+    if (slots_ready)
+        return 0;
+
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        play_slot_t *slot = &slots[i];
+
+        slot->player.fifo = fifo_create(PLAYER_FIFO_SIZE, FIFO_BACKING_SPIRAM);
+        if (slot->player.fifo == NULL) {
+            ESP_LOGE(TAG, "couldn't allocate FIFO");
+            return -1;
+        }
+
+        slot->player.command = CMD_NONE;
+        slot->player.decoder_status = UNINITIALIZED;
+        slot->player.decoder_command = CMD_NONE;
+        slot->player.buffer_pref = BUF_PREF_SAFE;
+        slot->player.media_stream = &slot->media_stream;
+        slot->player.stream_done = on_stream_done;
+        slot->player.user_data = slot;
+
+        slot->radio.player_config = &slot->player;
+        slot->radio.finished = on_fetch_finished;
+        slot->radio.user_data = slot;
+
+        web_radio_init(&slot->radio);
+    }
+
+    slots_ready = true;
+    return 0;
+}
+
+static bool lock_queue()
+{
+    if (queue_lock == NULL) {
+        queue_lock = xSemaphoreCreateMutex();
+        if (queue_lock == NULL)
+            return false;
+    }
+
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    return true;
+}
+
+int play_queue_play(const char *url, const char *token, play_behavior_t behavior)
+{
+    if (!lock_queue())
+        return -1;
+
+    int ret = -1;
+
+    if (init_slots() != 0)
+        goto out;
+
+    switch (behavior) {
+        case PLAY_REPLACE_ALL:
+            // the new stream plays right away, the stopped ones release the output
+            paused = false;
+            clear_pending();
+            abort_all();
+            break;
+
+        case PLAY_REPLACE_ENQUEUED:
+            clear_pending();
+            abort_enqueued();
+            break;
+
+        case PLAY_ENQUEUE:
+            break;
+    }
+
+    if (pending_count == PLAY_QUEUE_LEN) {
+        ESP_LOGE(TAG, "queue full, dropping %s", url);
+        goto out;
+    }
+
+    play_item_t *item = &pending[(pending_head + pending_count) % PLAY_QUEUE_LEN];
+    item->url = strdup(url);
+    item->token = token ? strdup(token) : NULL;
+    pending_count++;
+
+    // waits for a slot otherwise, the one that gets free starts it
+    start_next();
+    ret = 0;
+
+    out:
+    xSemaphoreGive(queue_lock);
+    return ret;
+}
+
+void play_queue_clear(clear_behavior_t behavior)
+{
+    if (!lock_queue())
+        return;
+
+    clear_pending();
+
+    if (slots_ready) {
+        if (behavior == CLEAR_ALL) {
+            paused = false;
+            abort_all();
+        } else {
+            abort_enqueued();
+        }
+    }
+
+    xSemaphoreGive(queue_lock);
+}
+
+/* the stream heard now, or the one heard last */
+static play_slot_t *audible_slot()
+{
+    play_slot_t *current = NULL;
+    play_slot_t *last = NULL;
+
+    for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+        play_slot_t *slot = &slots[i];
+
+        if (!slot_idle(slot) && (current == NULL || slot->seq < current->seq))
+            current = slot;
+
+        // a stream stopped before its decoder ran was never heard
+        if (slot->player.stream_id != 0 && (last == NULL || slot->seq > last->seq))
+            last = slot;
+    }
+
+    return current ? current : last;
+}
+
+void play_queue_pause()
+{
+    if (!lock_queue())
+        return;
+
+    // the one playing and the next one, should it start meanwhile
+    for (int i = 0; slots_ready && i < PLAY_QUEUE_SLOTS; i++) {
+        if (!slot_idle(&slots[i])) {
+            paused = true;
+            audio_player_pause(&slots[i].player);
+        }
+    }
+
+    if (paused)
+        ESP_LOGI(TAG, "paused");
+
+    xSemaphoreGive(queue_lock);
+}
+
+void play_queue_resume()
+{
+    if (!lock_queue())
+        return;
+
+    if (paused) {
+        paused = false;
+        for (int i = 0; i < PLAY_QUEUE_SLOTS; i++) {
+            audio_player_resume(&slots[i].player);
+        }
+
+        ESP_LOGI(TAG, "resumed");
+    }
+
+    xSemaphoreGive(queue_lock);
+}
+
+play_activity_t play_queue_get_state(char **token, uint32_t *offset_ms)
+{
+    play_activity_t activity = PLAY_IDLE;
+
+    *token = NULL;
+    *offset_ms = 0;
+
+    if (!lock_queue())
+        return activity;
+
+    play_slot_t *slot = slots_ready ? audible_slot() : NULL;
+    if (slot != NULL) {
+        if (!slot_idle(slot))
+            activity = paused ? PLAY_PAUSED : PLAY_PLAYING;
+        else
+            activity = slot->stopped ? PLAY_STOPPED : PLAY_FINISHED;
+
+        // the renderer keeps the count of one stream after it ended
+        *offset_ms = max(player_get_position_ms(&slot->player), slot->done_ms);
+        *token = slot->item.token ? strdup(slot->item.token) : NULL;
+    }
+
+    xSemaphoreGive(queue_lock);
+    return activity;
+}
@@ -20,7 +20,8 @@
 #include "multipart_parser.h"
 #include "common_buffer.h"
 #include "audio_player.h"
-#include "web_radio.h"
+#include "audio_renderer.h"
+#include "play_queue.h"
 #include "ui.h"
 #include "alexa.h"
 #include "alexa_speech_recognizer.h"
@@ -34,34 +35,14 @@ void handle_speak_directive(alexa_session_t *alexa_session, cJSON *directive)
     ;
 }
 
-static void start_web_radio(char *play_url)
-{
-    // init web radio
-    web_radio_t *radio_config = calloc(1, sizeof(web_radio_t));
-    radio_config->url = play_url;
-
-    // init player config
-    radio_config->player_config = calloc(1, sizeof(player_t));
-    radio_config->player_config->command = CMD_NONE;
-    radio_config->player_config->decoder_status = UNINITIALIZED;
-    radio_config->player_config->decoder_command = CMD_NONE;
-    radio_config->player_config->buffer_pref = BUF_PREF_SAFE;
-    radio_config->player_config->media_stream = calloc(1, sizeof(media_stream_t));
-
-    // init renderer
-    // renderer_init(create_renderer_config());
-
-    // start radio
-    web_radio_init(radio_config);
-    web_radio_start(radio_config);
-}
-
 void handle_play_directive(alexa_session_t *alexa_session, cJSON *directive)
 {
     cJSON *payload = cJSON_GetObjectItem(directive, "payload");
+    cJSON *behavior = cJSON_GetObjectItem(payload, "playBehavior");
     cJSON *audioItem = cJSON_GetObjectItem(payload, "audioItem");
     cJSON *stream = cJSON_GetObjectItem(audioItem, "stream");
     cJSON *url = cJSON_GetObjectItem(stream, "url");
+    cJSON *token = cJSON_GetObjectItem(stream, "token");
 
     // inline audio
     if(strncmp("cid", url->valuestring, 3) == 0)
@@ -70,7 +51,51 @@ void handle_play_directive(alexa_session_t *alexa_session, cJSON *directive)
     }
 
     ESP_LOGI(TAG, "playing url %s", url->valuestring);
-    start_web_radio(strdup(url->valuestring));
+    play_queue_play(url->valuestring, token ? token->valuestring : NULL,
+            play_behavior_from_string(behavior ? behavior->valuestring : NULL));
+}
+
+void handle_clear_queue_directive(alexa_session_t *alexa_session, cJSON *directive)
+{
+    cJSON *payload = cJSON_GetObjectItem(directive, "payload");
+    cJSON *behavior = cJSON_GetObjectItem(payload, "clearBehavior");
+
+    if(behavior != NULL && strcmp(behavior->valuestring, "CLEAR_ALL") == 0)
+        play_queue_clear(CLEAR_ALL);
+    else
+        play_queue_clear(CLEAR_ENQUEUED);
+}
+
+/* SetVolume, AdjustVolume and SetMute, the next event reports the new state */
+void handle_speaker_directive(alexa_session_t *alexa_session, cJSON *directive, const char *name)
+{
+    cJSON *payload = cJSON_GetObjectItem(directive, "payload");
+
+    if(strcmp(name, "SetMute") == 0) {
+        cJSON *mute = cJSON_GetObjectItem(payload, "mute");
+        if(mute != NULL) {
+            renderer_set_mute(mute->type == cJSON_True);
+        }
+        return;
+    }
+
+    cJSON *volume = cJSON_GetObjectItem(payload, "volume");
+    if(volume == NULL) {
+        return;
+    }
+
+    int value = volume->valueint;
+    if(strcmp(name, "AdjustVolume") == 0) {
+        value += renderer_get_volume();
+    } else if(strcmp(name, "SetVolume") != 0) {
+        return;
+    }
+
+    if(value < 0) value = 0;
+    if(value > RENDERER_VOLUME_MAX) value = RENDERER_VOLUME_MAX;
+
+    ESP_LOGI(TAG, "%s: volume %d", name, value);
+    renderer_set_volume(value);
 }
 
 void handle_directive(alexa_session_t *alexa_session, const char *at, size_t length)
@@ -84,13 +109,22 @@ void handle_directive(alexa_session_t *alexa_session, const char *at, size_t len
 
     cJSON *directive = cJSON_GetObjectItem(root, "directive");
     cJSON *header = cJSON_GetObjectItem(directive, "header");
+    cJSON *namespace = cJSON_GetObjectItem(header, "namespace");
     cJSON *name = cJSON_GetObjectItem(header, "name");
 
-    if(strstr(name->valuestring, "Speak"))
+    if(namespace != NULL && strcmp(namespace->valuestring, "Speaker") == 0)
+    {
+        handle_speaker_directive(alexa_session, directive, name->valuestring);
+    }
+    else if(strstr(name->valuestring, "Speak"))
     {
         ui_queue_event(UI_SYNTHESIZING_SPEECH);
         handle_speak_directive(alexa_session, directive);
     }
+    else if(strcmp(name->valuestring, "ClearQueue") == 0)
+    {
+        handle_clear_queue_directive(alexa_session, directive);
+    }
     else if(strstr(name->valuestring, "Play"))
     {
         handle_play_directive(alexa_session, directive);
@@ -100,6 +134,110 @@ void handle_directive(alexa_session_t *alexa_session, const char *at, size_t len
 }
 
 
+/*
+ * Audio parts are fed to the player without blocking, this runs on the event
+ * loop that also serves the downchannel. What doesn't fit into the FIFO is
+ * parked in a backlog, and the stream's flow control window is only returned
+ * to the server as the backlog drains. A server that sends faster than we
+ * play is throttled by HTTP/2 flow control, the backlog never exceeds the
+ * stream window.
+ */
+#define AUDIO_BACKLOG_INITIAL_SIZE 4096
+
+size_t stream_handler_events_audio_backlog(alexa_stream_t *alexa_stream)
+{
+    if(alexa_stream->audio_backlog == NULL)
+        return 0;
+
+    return buf_data_unread(alexa_stream->audio_backlog);
+}
+
+static void release_window(alexa_stream_t *alexa_stream, size_t n)
+{
+    nghttp2_session *h2 = alexa_stream->http2_session->h2_session;
+    nghttp2_session_consume_stream(h2, alexa_stream->backlog_stream_id, n);
+}
+
+static void audio_part_complete(alexa_stream_t *alexa_stream)
+{
+    player_t *player_config = get_player_config(alexa_stream->alexa_session);
+
+    alexa_stream->audio_eof_pending = false;
+    player_config->media_stream->eof = true;
+    // ensure flush
+    audio_stream_consumer(NULL, 0, player_config);
+}
+
+void stream_handler_events_drain_audio(alexa_stream_t *alexa_stream)
+{
+    size_t pending = stream_handler_events_audio_backlog(alexa_stream);
+    if(pending == 0)
+        return;
+
+    buffer_t *backlog = alexa_stream->audio_backlog;
+    player_t *player_config = get_player_config(alexa_stream->alexa_session);
+
+    ssize_t n = audio_stream_offer((const char *) backlog->read_pos, pending, player_config);
+    if(n < 0) {
+        // player was stopped, nobody wants the rest
+        n = pending;
+    }
+    if(n == 0)
+        return;
+
+    buf_drain(backlog, n);
+    release_window(alexa_stream, n);
+
+    if(buf_data_unread(backlog) == 0) {
+        buf_reset(backlog);
+        if(alexa_stream->audio_eof_pending)
+            audio_part_complete(alexa_stream);
+    }
+}
+
+void stream_handler_events_claim_audio(alexa_stream_t *alexa_stream, int32_t stream_id)
+{
+    size_t pending = stream_handler_events_audio_backlog(alexa_stream);
+
+    if(pending > 0 && alexa_stream->backlog_stream_id != stream_id) {
+        ESP_LOGW(TAG, "stream %d superseded, dropping %d bytes of audio",
+                alexa_stream->backlog_stream_id, pending);
+        release_window(alexa_stream, pending);
+        buf_reset(alexa_stream->audio_backlog);
+        alexa_stream->audio_eof_pending = false;
+    }
+
+    alexa_stream->backlog_stream_id = stream_id;
+}
+
+/* never blocks, anything the FIFO can't take goes into the backlog */
+static void on_audio_data(alexa_stream_t *alexa_stream, const char *at, size_t length)
+{
+    player_t *player_config = get_player_config(alexa_stream->alexa_session);
+    ssize_t taken = 0;
+
+    // nothing may overtake the backlog
+    if(stream_handler_events_audio_backlog(alexa_stream) == 0) {
+        taken = audio_stream_offer(at, length, player_config);
+        if(taken < 0)
+            return;
+    }
+
+    if(taken == length)
+        return;
+
+    if(alexa_stream->audio_backlog == NULL)
+        alexa_stream->audio_backlog = buf_create(max(length - taken, AUDIO_BACKLOG_INITIAL_SIZE));
+
+    if(alexa_stream->audio_backlog == NULL
+            || buf_reserve(alexa_stream->audio_backlog, length - taken) != 0) {
+        ESP_LOGE(TAG, "dropping %d bytes of audio", length - taken);
+        return;
+    }
+    buf_write(alexa_stream->audio_backlog, at + taken, length - taken);
+}
+
+
 /* multipart callbacks */
 static int on_multipart_header_field(multipart_parser *parser, const char *at, size_t length)
 {
@@ -121,6 +259,8 @@ static int on_multipart_header_value(multipart_parser *parser, const char *at, s
         player_t *player_config = get_player_config(alexa_session);
         player_config->media_stream->eof = false;
         player_config->media_stream->content_type = AUDIO_MPEG;
+        // carries on where a part still in the backlog left off
+        alexa_stream->audio_eof_pending = false;
 
         printf("starting player\n");
         audio_player_start(player_config);
@@ -133,7 +273,9 @@ static int on_multipart_header_value(multipart_parser *parser, const char *at, s
     return 0;
 }
 
+/* reused for every JSON part, only grows when a larger one comes along */
 static buffer_t *json_buf = NULL;
+#define JSON_BUF_INITIAL_SIZE 1024
 static int on_multipart_data(multipart_parser *parser, const char *at, size_t length)
 {
     alexa_stream_t *alexa_stream = multipart_parser_get_data(parser);
@@ -142,22 +284,20 @@ static int on_multipart_data(multipart_parser *parser, const char *at, size_t le
     if(alexa_stream->current_part == AUDIO_DATA)
     {
         // ESP_LOGI("feeding player\n");
-        player_t *player_config = get_player_config(alexa_session);
-        audio_stream_consumer(at, length, player_config);
+        on_audio_data(alexa_stream, at, length);
     }
     else if(alexa_stream->current_part == META_JSON)
     {
         //printf("on_multipart_data:\n%.*s\n", length, at);
 
         if(json_buf == NULL)
-            json_buf = buf_create(length);
+            json_buf = buf_create(max(length, JSON_BUF_INITIAL_SIZE));
 
-        int bytes_written = buf_write(json_buf, at, length);
-        int bytes_remaining = length - bytes_written;
-        if(bytes_remaining > 0) {
-            buf_resize(json_buf, json_buf->len + bytes_remaining);
-            buf_write(json_buf, at + bytes_written, bytes_remaining);
+        if(buf_reserve(json_buf, length) != 0) {
+            ESP_LOGE(TAG, "dropping %d bytes of json", length);
+            return 0;
         }
+        buf_write(json_buf, at, length);
 
     }
     else {
@@ -187,16 +327,24 @@ static int on_multipart_data_end(multipart_parser *parser)
     printf("on_part_data_end\n");
 
     if(alexa_stream->current_part == AUDIO_DATA) {
-        player_t *player_config = get_player_config(alexa_session);
-        player_config->media_stream->eof = true;
-        // ensure flush
-        audio_stream_consumer(NULL, 0, player_config);
+        // the end of the stream must not overtake the backlog either
+        if(stream_handler_events_audio_backlog(alexa_stream) > 0)
+            alexa_stream->audio_eof_pending = true;
+        else
+            audio_part_complete(alexa_stream);
     }
 
     if(alexa_stream->current_part == META_JSON) {
-        handle_directive(alexa_session, (const char *) json_buf->base, json_buf->len);
-        buf_destroy(json_buf);
-        json_buf = NULL;
+        if(json_buf == NULL || buf_data_unread(json_buf) == 0) {
+            ESP_LOGW(TAG, "empty JSON part");
+            return 0;
+        }
+
+        // cJSON wants a terminated string
+        if(buf_reserve(json_buf, 1) == 0)
+            *json_buf->write_pos = '\0';
+        handle_directive(alexa_session, (const char *) json_buf->read_pos, buf_data_unread(json_buf));
+        buf_reset(json_buf);
     }
 
     return 0;
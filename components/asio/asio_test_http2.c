@@ -44,6 +44,7 @@ void asio_test_http2()
                             NULL, 0,
                             NULL,
                             callbacks,
+                            NULL,
                             NULL, NULL);
 
     res = asio_new_http2_session(
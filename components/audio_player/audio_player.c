@@ -6,119 +6,470 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 
 #include "audio_player.h"
-#include "spiram_fifo.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include "esp_system.h"
 #include "esp_log.h"
 
-#include "fdk_aac_decoder.h"
-#include "libfaad_decoder.h"
-#include "mp3_decoder.h"
 #include "controls.h"
+#include "bitrate.h"
+#include "codec.h"
+#include "ui.h"
 
 #define TAG "audio_player"
 #define PRIO_MAD configMAX_PRIORITIES - 2
 
+/* streams waiting for a decoder worker, more than one only while switching */
+#define DECODER_QUEUE_LEN 4
+
+/* seems 4k is enough to prevent initial buffer underflow */
+#define MIN_START_THRESHOLD 4096
+
+/* arrival rates measured over less than this are mostly noise */
+#define MIN_RATE_WINDOW_MS 250
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 static player_t *player_instance = NULL;
 static component_status_t player_status = UNINITIALIZED;
 
-static int start_decoder_task(player_t *player)
+/* asks the decoder worker to play a stream */
+typedef struct {
+    player_t *player;
+    const codec_t *codec;
+} decoder_cmd_t;
+
+/* One per renderer source. Dialog and content decode at the same time, a
+ * spoken answer doesn't wait for the radio stream to end. */
+typedef struct {
+    QueueHandle_t queue;
+    TaskHandle_t handle;
+    uint32_t stack_size;
+    /* the player whose stream the worker decodes, NULL between streams */
+    player_t *volatile decoding_player;
+} decoder_worker_t;
+
+static decoder_worker_t workers[RENDERER_SOURCE_COUNT];
+
+/* Holds the stream between two frames. The codec keeps its state and the
+ * FIFO its data, a full FIFO holds up the reader and with it the sender. */
+static void wait_resumed(player_t *player)
 {
-    TaskFunction_t task_func;
-    char * task_name;
-    uint16_t stack_depth;
+    ESP_LOGI(TAG, "decoder paused");
 
-    ESP_LOGI(TAG, "RAM left %d", esp_get_free_heap_size());
+    // audio_player_resume() and audio_player_abort() wake it
+    while (player->decoder_command == CMD_PAUSE) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
 
-    switch (player->media_stream->content_type)
-    {
-        case AUDIO_MPEG:
-            task_func = mp3_decoder_task;
-            task_name = "mp3_decoder_task";
-            stack_depth = 8448;
-            break;
+    ESP_LOGI(TAG, "decoder resumed");
+}
 
-        case AUDIO_MP4:
-            task_func = libfaac_decoder_task;
-            task_name = "libfaac_decoder_task";
-            stack_depth = 55000;
-            break;
+/* Decodes the streams of one renderer source one after the other. The codecs
+ * keep their buffers per source between streams, nothing is allocated per
+ * stream but the codec instances. A stream
+ * queued while another one plays starts right after its last frame, the
+ * renderer keeps running in between. */
+static void decoder_worker(void *pvParameters)
+{
+    decoder_worker_t *worker = pvParameters;
+    decoder_cmd_t cmd;
 
-        case AUDIO_AAC:
-        case OCTET_STREAM: // probably .aac
-            task_func = fdkaac_decoder_task;
-            task_name = "fdkaac_decoder_task";
-            stack_depth = 6144;
-            break;
+    while (1) {
+        xQueueReceive(worker->queue, &cmd, portMAX_DELAY);
+        player_t *player = cmd.player;
+        worker->decoding_player = player;
+
+        ESP_LOGI(TAG, "%s decoder start, RAM left %d", cmd.codec->name,
+                esp_get_free_heap_size());
+
+        // the renderer counts the samples of each stream on their own
+        player->stream_id = renderer_start_stream(player->source);
+
+        uint32_t frames = 0;
+        if (cmd.codec->open(player) == 0) {
+            while (player->decoder_command != CMD_STOP) {
+                if (player->decoder_command == CMD_PAUSE) {
+                    wait_resumed(player);
+                    continue;
+                }
+
+                if (cmd.codec->decode_frame(player) != CODEC_OK)
+                    break;
+                frames++;
+            }
+        }
+        cmd.codec->close(player);
+
+        // An aborted stream fades out, a finished one plays to the end. One
+        // stopped before it played leaves the previous stream's tail alone.
+        if(player->decoder_command == CMD_STOP && frames > 0) {
+            renderer_flush(player->source);
+        }
+
+        // a stopped stream doesn't leave the next one paused, one that
+        // ended while a pause came in keeps the output held
+        if(player->decoder_command != CMD_PAUSE) {
+            renderer_pause(player->source, false);
+        }
+
+        fifo_dump_stats(player->fifo, TAG);
+        renderer_dump_stats();
+
+        // discard whatever is left of this stream
+        fifo_reset(player->fifo);
+
+        worker->decoding_player = NULL;
+        player->decoder_status = STOPPED;
+        player->decoder_command = CMD_NONE;
+        ESP_LOGI(TAG, "decoder stopped, stack left: %d", uxTaskGetStackHighWaterMark(NULL));
+
+        ui_queue_event(UI_NONE);
+
+        if (player->stream_done != NULL) {
+            player->stream_done(player);
+        }
+    }
+}
+
+/* Created once. The stacks are taken while the heap is still in one piece.
+ * Content may be any stream, its worker is sized for the codec that needs
+ * most. Dialog is the assistant's speech, MP3. */
+static int start_decoder_worker(renderer_source_t source)
+{
+    static const char *names[RENDERER_SOURCE_COUNT] = {
+        [RENDERER_SOURCE_CONTENT] = "decoder_content",
+        [RENDERER_SOURCE_DIALOG] = "decoder_dialog"
+    };
+    decoder_worker_t *worker = &workers[source];
+
+    if (worker->queue != NULL)
+        return 0;
+
+    uint32_t stack_depth = source == RENDERER_SOURCE_DIALOG
+            ? codec_for_content_type(AUDIO_MPEG)->stack_size
+            : codec_max_stack_size();
 
-        default:
-            ESP_LOGE(TAG, "unknown mime type: %d", player->media_stream->content_type);
-            return -1;
+    QueueHandle_t queue = xQueueCreate(DECODER_QUEUE_LEN, sizeof(decoder_cmd_t));
+    if (queue == NULL) {
+        ESP_LOGE(TAG, "ERROR creating decoder queue! Out of memory?");
+        return -1;
     }
+    worker->queue = queue;
+    worker->stack_size = stack_depth;
 
-    if (xTaskCreatePinnedToCore(task_func, task_name, stack_depth, player,
-    PRIO_MAD, NULL, 1) != pdPASS) {
+    if (xTaskCreatePinnedToCore(decoder_worker, names[source], stack_depth, worker,
+    PRIO_MAD, &worker->handle, 1) != pdPASS) {
         ESP_LOGE(TAG, "ERROR creating decoder task! Out of memory?");
+        vQueueDelete(queue);
+        worker->queue = NULL;
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "created %s, %u bytes stack", names[source], stack_depth);
+
+    return 0;
+}
+
+static int start_decoder_task(player_t *player)
+{
+    decoder_worker_t *worker = &workers[player->source];
+    decoder_cmd_t cmd = {
+        .player = player,
+        .codec = codec_for_content_type(player->media_stream->content_type)
+    };
+
+    if (cmd.codec == NULL) {
+        ESP_LOGE(TAG, "unknown mime type: %d", player->media_stream->content_type);
+        return -1;
+    }
+
+    if (worker->queue == NULL) {
+        ESP_LOGE(TAG, "decoder worker not running");
+        return -1;
+    }
+
+    if (cmd.codec->stack_size > worker->stack_size) {
+        ESP_LOGE(TAG, "%s needs %u bytes stack, the worker has %u",
+                cmd.codec->name, cmd.codec->stack_size, worker->stack_size);
         return -1;
-    } else {
-        player->decoder_status = RUNNING;
     }
 
-    ESP_LOGI(TAG, "created decoder task: %s", task_name);
+    player->decoder_status = RUNNING;
+
+    if (xQueueSend(worker->queue, &cmd, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "decoder worker busy");
+        player->decoder_status = STOPPED;
+        return -1;
+    }
 
     return 0;
 }
 
+void audio_player_pause(player_t *player)
+{
+    if (player->decoder_command != CMD_STOP) {
+        player->decoder_command = CMD_PAUSE;
+    }
+
+    // what is already decoded waits in the renderer
+    renderer_pause(player->source, true);
+}
+
+void audio_player_resume(player_t *player)
+{
+    if (player->decoder_command == CMD_PAUSE) {
+        player->decoder_command = CMD_NONE;
+    }
+
+    renderer_pause(player->source, false);
+
+    if (workers[player->source].handle != NULL) {
+        xTaskNotifyGive(workers[player->source].handle);
+    }
+}
+
+void audio_player_abort(player_t *player)
+{
+    bool paused = player->decoder_command == CMD_PAUSE;
+
+    player->decoder_command = CMD_STOP;
+
+    // A paused decoder may wait for room in the held PCM ring. Dropping what
+    // it holds lets the decoder get to the stop, nothing of it is heard. A
+    // stream still waiting for the worker has nothing in there.
+    if (paused && player == workers[player->source].decoding_player) {
+        renderer_flush(player->source);
+    }
+
+    if (workers[player->source].handle != NULL) {
+        xTaskNotifyGive(workers[player->source].handle);
+    }
+}
+
+uint32_t player_get_position_ms(player_t *player)
+{
+    return renderer_get_stream_position_ms(player->source, player->stream_id);
+}
+
+static uint32_t prebuffer_default(player_t *player)
+{
+    return player->buffer_pref == BUF_PREF_FAST ? PREBUFFER_MS_FAST : PREBUFFER_MS_SAFE;
+}
+
+/* bytes/s the network delivered since the stream started, 0 if unknown */
+static uint32_t arrival_rate(stream_rate_t *rate)
+{
+    uint32_t elapsed = esp_log_timestamp() - rate->start_ms;
+    if (rate->start_ms == 0 || elapsed < MIN_RATE_WINDOW_MS)
+        return 0;
+
+    return (uint64_t) rate->bytes_received * 1000 / elapsed;
+}
+
+int audio_player_start_threshold(player_t *player)
+{
+    stream_rate_t *rate = &player->rate;
+    int size = fifo_len(player->fifo);
+    int ceiling = size * 9 / 10;
+
+    // nothing to measure playback time with, use a share of the buffer
+    if (rate->bitrate == 0) {
+        return player->buffer_pref == BUF_PREF_FAST ? size / 5 : ceiling;
+    }
+
+    uint32_t play_rate = rate->bitrate / 8;
+    uint64_t target = (uint64_t) play_rate * rate->prebuffer_ms / 1000;
+
+    // The network can't keep up and the buffer drains while playing. Buffer
+    // proportionally more so the underrun comes later rather than right away.
+    uint32_t in_rate = arrival_rate(rate);
+    if (in_rate > 0 && in_rate < play_rate) {
+        target = target * play_rate / in_rate;
+    }
+
+    if (target > ceiling)
+        target = ceiling;
+    if (target < MIN_START_THRESHOLD)
+        target = min(MIN_START_THRESHOLD, ceiling);
+
+    return target;
+}
+
+/* Picks the codec and reads the bitrate off the first frames, before the
+ * decoder owns the read side of the FIFO. Tried once, when the FIFO holds
+ * enough to see a frame and its successor. The stream is labelled with what
+ * was found, the decoder starts with the right codec right away. */
+static void sniff_stream(player_t *player, int bytes_in_buf)
+{
+    stream_rate_t *rate = &player->rate;
+
+    if (rate->sniffed || player->decoder_status == RUNNING)
+        return;
+    if (bytes_in_buf < FIFO_MIRROR_SIZE && !player->media_stream->eof)
+        return;
+
+    int len;
+    char *data = fifo_peek_contiguous(player->fifo, &len);
+    if (data != NULL) {
+        const codec_t *codec = codec_sniff((uint8_t *) data, len,
+                player->media_stream->content_type);
+        if (codec != NULL) {
+            player->media_stream->content_type = codec->content_type;
+        }
+
+        rate->bitrate = sniff_bitrate((uint8_t *) data, len,
+                player->media_stream->content_type);
+    }
+    rate->sniffed = true;
+
+    ESP_LOGI(TAG, "stream bitrate: %u bit/s", rate->bitrate);
+}
+
+/* Raise the target for every underrun while playing. Running dry at the end
+ * of the stream is expected. */
+static void track_underruns(player_t *player)
+{
+    stream_rate_t *rate = &player->rate;
+    uint32_t underruns = fifo_underrun_episodes(player->fifo);
+
+    if (underruns <= rate->underruns_seen || player->media_stream->eof)
+        return;
+
+    rate->underruns_seen = underruns;
+    rate->underrun_in_stream = true;
+    rate->prebuffer_ms = min(rate->prebuffer_ms * 3 / 2, PREBUFFER_MS_MAX);
+
+    ESP_LOGW(TAG, "underrun, buffering %u ms from now on", rate->prebuffer_ms);
+}
+
 static int t;
 
-/* Writes bytes into the FIFO queue, starts decoder task if necessary. */
-int audio_stream_consumer(const char *recv_buf, ssize_t bytes_read,
-        void *user_data)
+/* Copies straight into the ring, in as few pieces as the wrap point allows.
+ * Without block, stops at the first piece that finds the FIFO full. */
+static ssize_t stream_write(player_t *player, const char *recv_buf,
+        ssize_t bytes_read, bool block)
 {
-    player_t *player = user_data;
+    ssize_t written = 0;
 
-    // don't bother consuming bytes if stopped
-    if(player->command == CMD_STOP) {
-        player->decoder_command = CMD_STOP;
-        player->command = CMD_NONE;
-        return -1;
+    while (written < bytes_read) {
+        int bytes_avail;
+        char *dst = block
+                ? fifo_reserve(player->fifo, bytes_read - written, &bytes_avail)
+                : fifo_try_reserve(player->fifo, bytes_read - written, &bytes_avail);
+        if (dst == NULL)
+            break;
+
+        memcpy(dst, recv_buf + written, bytes_avail);
+        fifo_commit(player->fifo, bytes_avail);
+        written += bytes_avail;
     }
 
-    if (bytes_read > 0) {
-        spiRamFifoWrite(recv_buf, bytes_read);
+    if (player->rate.start_ms == 0 && written > 0) {
+        player->rate.start_ms = esp_log_timestamp();
     }
+    player->rate.bytes_received += written;
 
-    int bytes_in_buf = spiRamFifoFill();
-    uint8_t fill_level = (bytes_in_buf * 100) / spiRamFifoLen();
+    return written;
+}
+
+/* starts the decoder once enough is buffered */
+static int stream_written(player_t *player)
+{
+    stream_rate_t *rate = &player->rate;
+
+    // lets a reader blocked on more data than will ever come return early
+    fifo_set_eof(player->fifo, player->media_stream->eof);
+
+    int bytes_in_buf = fifo_fill(player->fifo);
+    sniff_stream(player, bytes_in_buf);
+    int threshold = audio_player_start_threshold(player);
 
-    // seems 4k is enough to prevent initial buffer underflow
-    uint8_t min_fill_lvl = player->buffer_pref == BUF_PREF_FAST ? 20 : 90;
-    bool enough_buffer = fill_level > min_fill_lvl;
+    if (player->decoder_status == RUNNING) {
+        track_underruns(player);
+    } else if (player->command != CMD_STOP) {
+        bool early_start = (bytes_in_buf > 1028 && player->media_stream->eof);
+        if (bytes_in_buf >= threshold || early_start) {
 
-    bool early_start = (bytes_in_buf > 1028 && player->media_stream->eof);
-    if (player->decoder_status != RUNNING && (enough_buffer || early_start)) {
+            ESP_LOGI(TAG, "starting decoder at %d bytes, arriving at %u bytes/s",
+                    bytes_in_buf, arrival_rate(rate));
 
-        // buffer is filled, start decoder
-        if (start_decoder_task(player) != 0) {
-            ESP_LOGE(TAG, "failed to start decoder task");
-            return -1;
+            // only underruns during playback count
+            rate->underruns_seen = fifo_underrun_episodes(player->fifo);
+
+            // buffer is filled, start decoder
+            if (start_decoder_task(player) != 0) {
+                ESP_LOGE(TAG, "failed to start decoder task");
+                return -1;
+            }
         }
     }
 
     t = (t + 1) & 255;
     if (t == 0) {
-        ESP_LOGI(TAG, "Buffer fill %u%%, %d bytes", fill_level, bytes_in_buf);
+        ESP_LOGI(TAG, "Buffer fill %d/%d bytes, threshold %d", bytes_in_buf,
+                fifo_len(player->fifo), threshold);
     }
 
     return 0;
 }
 
+static bool stream_stopped(player_t *player)
+{
+    // don't bother consuming bytes if stopped
+    if(player->command == CMD_STOP) {
+        audio_player_abort(player);
+        player->command = CMD_NONE;
+        return true;
+    }
+
+    return false;
+}
+
+/* Writes bytes into the FIFO queue, starts decoder task if necessary. */
+int audio_stream_consumer(const char *recv_buf, ssize_t bytes_read,
+        void *user_data)
+{
+    player_t *player = user_data;
+
+    if (stream_stopped(player))
+        return -1;
+
+    stream_write(player, recv_buf, bytes_read, true);
+    return stream_written(player);
+}
+
+ssize_t audio_stream_offer(const char *recv_buf, ssize_t bytes_read,
+        player_t *player)
+{
+    if (stream_stopped(player))
+        return -1;
+
+    ssize_t written = stream_write(player, recv_buf, bytes_read, false);
+    if (stream_written(player) != 0)
+        return -1;
+
+    return written;
+}
+
 void audio_player_init(player_t *player)
 {
+    for (int source = 0; source < RENDERER_SOURCE_COUNT; source++) {
+        if (start_decoder_worker(source) != 0) {
+            ESP_LOGE(TAG, "no decoder for source %d, its streams won't play", source);
+        }
+    }
+
     player_instance = player;
     player_status = INITIALIZED;
 }
@@ -129,8 +480,25 @@ void audio_player_destroy()
     player_status = UNINITIALIZED;
 }
 
-void audio_player_start()
+/* Called when a new stream begins. A target raised by underruns is kept for
+ * the next stream, and relaxed again after one that played cleanly. */
+void audio_player_start(player_t *player)
 {
+    stream_rate_t *rate = &player->rate;
+    uint32_t base = prebuffer_default(player);
+
+    if (rate->prebuffer_ms < base) {
+        rate->prebuffer_ms = base;
+    } else if (!rate->underrun_in_stream) {
+        rate->prebuffer_ms = max(rate->prebuffer_ms * 3 / 4, base);
+    }
+
+    rate->start_ms = 0;
+    rate->bytes_received = 0;
+    rate->bitrate = 0;
+    rate->sniffed = false;
+    rate->underrun_in_stream = false;
+
     renderer_start();
     player_status = RUNNING;
 }
@@ -145,4 +513,3 @@ component_status_t get_player_status()
 {
     return player_status;
 }
-
@@ -0,0 +1,151 @@
+/*
+ * bitrate.c
+ *
+ * Reads the bitrate from the first frame headers of a stream, so the player
+ * can tell how many seconds of playback are buffered.
+ *
+ *  Created on: 23.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdbool.h>
+
+#include "bitrate.h"
+
+/* kbps, indexed by [version is MPEG-1 ? 0 : 1][layer - 1][bitrate index] */
+static const uint16_t mpeg_bitrates[2][3][15] = {
+    {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }
+    },
+    {
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+    }
+};
+
+/* Hz, indexed by [version bits][sample rate index] */
+static const uint16_t mpeg_sample_rates[4][3] = {
+    { 11025, 12000, 8000 },     // MPEG-2.5
+    { 0, 0, 0 },                // reserved
+    { 22050, 24000, 16000 },    // MPEG-2
+    { 44100, 48000, 32000 }     // MPEG-1
+};
+
+static const uint32_t adts_sample_rates[16] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+    16000, 12000, 11025, 8000, 7350, 0, 0, 0
+};
+
+/* returns the frame length in bytes and stores the bitrate, 0 if invalid */
+static uint32_t mpeg_frame(const uint8_t *p, uint32_t *bitrate)
+{
+    if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+        return 0;
+
+    uint8_t version = (p[1] >> 3) & 3;
+    uint8_t layer = 4 - ((p[1] >> 1) & 3);
+    uint8_t br_idx = p[2] >> 4;
+    uint8_t sr_idx = (p[2] >> 2) & 3;
+    uint8_t padding = (p[2] >> 1) & 1;
+
+    if (version == 1 || layer == 4 || br_idx == 0 || br_idx == 15 || sr_idx == 3)
+        return 0;
+
+    uint32_t kbps = mpeg_bitrates[version == 3 ? 0 : 1][layer - 1][br_idx];
+    uint32_t sample_rate = mpeg_sample_rates[version][sr_idx];
+    *bitrate = kbps * 1000;
+
+    if (layer == 1)
+        return (12 * *bitrate / sample_rate + padding) * 4;
+
+    // layer III of MPEG-2/2.5 carries half the samples per frame
+    uint32_t factor = (layer == 3 && version != 3) ? 72 : 144;
+    return factor * *bitrate / sample_rate + padding;
+}
+
+static uint32_t adts_frame(const uint8_t *p, uint32_t *bitrate)
+{
+    // sync word, layer always 0
+    if (p[0] != 0xFF || (p[1] & 0xF6) != 0xF0)
+        return 0;
+
+    uint32_t sample_rate = adts_sample_rates[(p[2] >> 2) & 0xF];
+    uint32_t frame_len = ((p[3] & 3) << 11) | (p[4] << 3) | (p[5] >> 5);
+
+    if (sample_rate == 0 || frame_len < 7)
+        return 0;
+
+    // 1024 samples per raw data block
+    uint32_t blocks = (p[6] & 3) + 1;
+    *bitrate = (uint64_t) frame_len * 8 * sample_rate / (1024 * blocks);
+    return frame_len;
+}
+
+typedef uint32_t (*frame_parser_t)(const uint8_t *, uint32_t *);
+
+static frame_parser_t parser_for(content_type_t content_type)
+{
+    switch (content_type) {
+        case AUDIO_MPEG:
+            return mpeg_frame;
+
+        case AUDIO_AAC:
+        case OCTET_STREAM:
+            return adts_frame;
+
+        default:
+            // MP4 keeps its bitrate in the container
+            return NULL;
+    }
+}
+
+/* offset of the first frame followed by a second one, stores its bitrate */
+static int first_frame(const uint8_t *data, size_t len, frame_parser_t parse,
+        uint32_t *bitrate)
+{
+    uint32_t next_bitrate;
+
+    // a header is 4 (MPEG) or 7 (ADTS) bytes
+    for (size_t i = 0; i + 7 <= len; i++) {
+        uint32_t frame_len = parse(data + i, bitrate);
+        if (frame_len == 0)
+            continue;
+
+        // a second header where the first one says it should be rules out
+        // sync words that happen to show up in ID3 tags or payload. A false
+        // sync may claim a frame longer than the window, a real one may
+        // still come after it.
+        if (i + frame_len + 7 > len)
+            continue;
+
+        if (parse(data + i + frame_len, &next_bitrate) != 0)
+            return i;
+    }
+
+    return -1;
+}
+
+int find_frame(const uint8_t *data, size_t len, content_type_t content_type)
+{
+    uint32_t bitrate;
+    frame_parser_t parse = parser_for(content_type);
+
+    if (parse == NULL)
+        return -1;
+
+    return first_frame(data, len, parse, &bitrate);
+}
+
+uint32_t sniff_bitrate(const uint8_t *data, size_t len, content_type_t content_type)
+{
+    uint32_t bitrate;
+    frame_parser_t parse = parser_for(content_type);
+
+    if (parse == NULL || first_frame(data, len, parse, &bitrate) < 0)
+        return 0;
+
+    return bitrate;
+}
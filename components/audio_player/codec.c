@@ -0,0 +1,119 @@
+/*
+ * codec.c
+ *
+ *  Created on: 30.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "codec.h"
+#include "fdk_aac_decoder.h"
+#include "libfaad_decoder.h"
+#include "mp3_decoder.h"
+
+#define TAG "codec"
+
+#define ID3V2_HEADER_SIZE 10
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+static const codec_t *codecs[] = {
+    &codec_mp3,
+    &codec_aac,
+    &codec_mp4
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+const codec_t *codec_for_content_type(content_type_t content_type)
+{
+    // nothing else to go by, most likely raw AAC
+    if (content_type == OCTET_STREAM)
+        content_type = AUDIO_AAC;
+
+    for (int i = 0; i < NUM_CODECS; i++) {
+        if (codecs[i]->content_type == content_type)
+            return codecs[i];
+    }
+
+    return NULL;
+}
+
+/* size of an ID3v2 tag at the start of data, 0 if there is none */
+static size_t id3v2_size(const uint8_t *data, size_t len)
+{
+    if (len < ID3V2_HEADER_SIZE || memcmp(data, "ID3", 3) != 0
+            || data[3] == 0xff || data[4] == 0xff
+            || ((data[6] | data[7] | data[8] | data[9]) & 0x80))
+        return 0;
+
+    // syncsafe, 7 bits per byte
+    size_t size = (data[6] << 21) | (data[7] << 14) | (data[8] << 7) | data[9];
+    size += ID3V2_HEADER_SIZE;
+
+    // footer
+    if (data[5] & 0x10)
+        size += ID3V2_HEADER_SIZE;
+
+    return size;
+}
+
+const codec_t *codec_sniff(const uint8_t *data, size_t len, content_type_t content_type)
+{
+    const codec_t *announced = codec_for_content_type(content_type);
+    const codec_t *found = NULL;
+    int found_at = -1;
+
+    size_t skip = id3v2_size(data, len);
+    if (skip >= len) {
+        // the tag hides the audio, but only MPEG streams come with one
+        found = announced ? announced : &codec_mp3;
+        ESP_LOGI(TAG, "%u bytes ID3 tag, assuming %s", skip, found->name);
+        return found;
+    }
+    data += skip;
+    len -= skip;
+
+    // the format that shows up first wins, the announced one on a tie
+    for (int i = 0; i < NUM_CODECS; i++) {
+        int offset = codecs[i]->probe(data, len);
+        if (offset < 0)
+            continue;
+
+        if (found == NULL || offset < found_at
+                || (offset == found_at && codecs[i] == announced)) {
+            found = codecs[i];
+            found_at = offset;
+        }
+    }
+
+    if (found == NULL) {
+        // most radio streams are MP3, worth a try if nothing was announced
+        found = announced ? announced : &codec_mp3;
+        ESP_LOGW(TAG, "format not recognised, content type %d, trying %s",
+                content_type, found->name);
+        return found;
+    }
+
+    if (found != announced) {
+        ESP_LOGW(TAG, "content type %d, but the stream is %s", content_type, found->name);
+    }
+
+    return found;
+}
+
+uint32_t codec_max_stack_size()
+{
+    uint32_t stack_size = 0;
+
+    for (int i = 0; i < NUM_CODECS; i++) {
+        stack_size = max(stack_size, codecs[i]->stack_size);
+    }
+
+    return stack_size;
+}
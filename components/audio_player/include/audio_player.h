@@ -11,12 +11,16 @@
 #include <sys/types.h>
 #include "common_component.h"
 #include "audio_renderer.h"
+#include "fifo.h"
+
+/* per-stream input buffer, in SPI RAM unless built with FAKE_SPI_BUFF */
+#define PLAYER_FIFO_SIZE (16 * 1024)
 
 int audio_stream_consumer(const char *recv_buf, ssize_t bytes_read, void *user_data);
 
 
 typedef enum {
-    CMD_NONE, CMD_START, CMD_STOP
+    CMD_NONE, CMD_START, CMD_STOP, CMD_PAUSE
 } player_command_t;
 
 typedef enum {
@@ -33,19 +37,75 @@ typedef struct {
     bool eof;
 } media_stream_t;
 
+/* playback time to buffer before the decoder starts, per buffer_pref */
+#define PREBUFFER_MS_FAST 500
+#define PREBUFFER_MS_SAFE 2000
+/* upper limit when underruns keep raising the target */
+#define PREBUFFER_MS_MAX 8000
+
+/* measured rates of the current stream, drive the start threshold */
 typedef struct {
+    uint32_t start_ms;          /* arrival of the first byte, 0 if none yet */
+    uint32_t bytes_received;
+    uint32_t bitrate;           /* bits/s of the audio, 0 if unknown */
+    bool sniffed;               /* bitrate detection was attempted */
+    uint32_t prebuffer_ms;      /* current target, adapted to underruns */
+    uint32_t underruns_seen;
+    bool underrun_in_stream;
+} stream_rate_t;
+
+typedef struct player {
     player_command_t command;
 
+    /* renderer input the player plays to, each has its own decoder worker */
+    renderer_source_t source;
+
     player_command_t decoder_command;
     component_status_t decoder_status;
     buffer_pref_t buffer_pref;
     media_stream_t *media_stream;
+    fifo_t *fifo;
+    stream_rate_t rate;
+    /* renderer id of the stream decoded last, for its position */
+    uint32_t stream_id;
+
+    /* optional, called on the decoder worker once a stream has played to
+     * the end or was stopped, and the FIFO is empty again */
+    void (*stream_done)(struct player *player);
+    void *user_data;
 } player_t;
 
+/**
+ * Like audio_stream_consumer(), but never blocks. Returns how many bytes fit
+ * into the FIFO, the caller has to offer the rest again later. -1 if the
+ * player was stopped.
+ */
+ssize_t audio_stream_offer(const char *recv_buf, ssize_t bytes_read, player_t *player);
+
 component_status_t get_player_status();
 
+/* bytes the FIFO should hold before playback starts or resumes */
+int audio_player_start_threshold(player_t *player);
+
+/**
+ * Holds the stream where it is: the decoder waits before its next frame,
+ * the renderer fades out and keeps what is decoded, and the FIFO fills up
+ * until the reader blocks, which throttles the connection. Also holds a
+ * stream that hasn't started decoding yet.
+ */
+void audio_player_pause(player_t *player);
+
+/* plays on from where audio_player_pause() held the stream */
+void audio_player_resume(player_t *player);
+
+/* stops the stream being decoded, a paused one included */
+void audio_player_abort(player_t *player);
+
+/* ms of the player's current or last stream that have been heard */
+uint32_t player_get_position_ms(player_t *player);
+
 void audio_player_init(player_t *player_config);
-void audio_player_start();
+void audio_player_start(player_t *player);
 void audio_player_stop();
 void audio_player_destroy();
 
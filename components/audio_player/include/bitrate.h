@@ -0,0 +1,29 @@
+/*
+ * bitrate.h
+ *
+ *  Created on: 23.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef _INCLUDE_BITRATE_H_
+#define _INCLUDE_BITRATE_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "audio_player.h"
+
+/**
+ * Scan for the first MPEG audio or ADTS frame header that is followed by a
+ * second valid header, returns its bitrate in bits/s or 0 if none was found.
+ * A single ADTS frame only gives an estimate, its size varies with content.
+ */
+uint32_t sniff_bitrate(const uint8_t *data, size_t len, content_type_t content_type);
+
+/**
+ * Offset of the first MPEG audio (AUDIO_MPEG) or ADTS (AUDIO_AAC) frame header
+ * that is followed by a second valid header, -1 if there is none.
+ */
+int find_frame(const uint8_t *data, size_t len, content_type_t content_type);
+
+#endif /* _INCLUDE_BITRATE_H_ */
@@ -0,0 +1,64 @@
+/*
+ * codec.h
+ *
+ * The decoders the player knows. The first bytes of a stream pick the one
+ * to use, the content type the server announced only decides when they
+ * don't tell.
+ *
+ *  Created on: 30.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef _INCLUDE_CODEC_H_
+#define _INCLUDE_CODEC_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "audio_player.h"
+
+/* results of decode_frame() */
+#define CODEC_OK     0
+#define CODEC_EOF    1
+#define CODEC_ERROR -1
+
+typedef struct codec
+{
+    const char *name;
+
+    /* what a stream is labelled as once this codec was sniffed */
+    content_type_t content_type;
+
+    /* stack the decoder worker needs to run this codec */
+    uint32_t stack_size;
+
+    /* offset of the first frame in the start of a stream, -1 if the bytes
+     * don't look like this codec's format */
+    int (*probe)(const uint8_t *data, size_t len);
+
+    /* prepares decoding the player's stream, -1 on failure */
+    int (*open)(player_t *player);
+
+    /* decodes and renders one frame, returns CODEC_OK, CODEC_EOF at the end
+     * of the stream and CODEC_ERROR if decoding can't go on */
+    int (*decode_frame)(player_t *player);
+
+    /* called after open(), also when it failed. The codec keeps its buffers
+     * for the next stream. */
+    void (*close)(player_t *player);
+} codec_t;
+
+/* the decoder for streams labelled as content_type, NULL if none */
+const codec_t *codec_for_content_type(content_type_t content_type);
+
+/**
+ * Picks the decoder by the first bytes of a stream. Falls back to the one
+ * for the announced content_type if no format was recognised, or to MP3
+ * if the content type names no codec. Never NULL.
+ */
+const codec_t *codec_sniff(const uint8_t *data, size_t len, content_type_t content_type);
+
+/* the stack one task needs to run any of the codecs */
+uint32_t codec_max_stack_size();
+
+#endif /* _INCLUDE_CODEC_H_ */
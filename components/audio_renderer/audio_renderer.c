@@ -9,79 +9,714 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "esp_log.h"
-#include "driver/gpio.h"
 #include "driver/i2s.h"
-#include "MerusAudio.h"
 
 #include "audio_player.h"
 #include "audio_renderer.h"
+#include "renderer_sink.h"
+#include "pcm_convert.h"
+#include "resampler.h"
+#include "mixer.h"
 
 #define TAG "renderer"
+#define PRIO_RENDERER configMAX_PRIORITIES - 1
+
+/* DMA that runs dry and gets samples again within this time had an
+ * underrun, a longer silence is taken for a gap between streams */
+#define RENDERER_UNDERRUN_GAP_MS 1000
+
+/* how often the renderer task looks at its state while waiting */
+#define RENDERER_POLL_TICKS pdMS_TO_TICKS(20)
+
+/* content level while the dialog plays, about -20 dB */
+#define RENDERER_DUCK_GAIN 3277
+
+/* the dialog counts as active for this long after its last frame, so gaps
+ * between sentences don't pump the content up and down */
+#define RENDERER_DUCK_HOLD_TICKS pdMS_TO_TICKS(500)
+
+/* volume 1 is this far below volume RENDERER_VOLUME_MAX, 0 is silent */
+#define RENDERER_VOLUME_RANGE_DB 50
+
+/*
+ * DMA depth per latency profile. Fewer, shorter buffers get a sound out
+ * sooner, more frames in DMA ride out longer stalls of the renderer task.
+ * Memory: (bits_per_sample / 8) * 2 * count * len
+ */
+typedef struct
+{
+    uint8_t dma_buf_count;      // number of buffers, 128 max.
+    uint16_t dma_buf_len;       // frames per buffer, 1024 max.
+} dma_profile_t;
+
+static const dma_profile_t dma_profiles[] = {
+    [LATENCY_LOW]       = { 4, 128 },   //  512 frames, ~12 ms at 44.1 kHz
+    [LATENCY_NORMAL]    = { 32, 64 },   // 2048 frames, ~46 ms
+    [LATENCY_DEEP]      = { 8, 512 },   // 4096 frames, ~93 ms
+};
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
 
 
 static renderer_config_t *renderer_instance = NULL;
 static component_status_t renderer_status = UNINITIALIZED;
-static QueueHandle_t i2s_event_queue;
+static const renderer_sink_t *sink;
+static QueueHandle_t sink_events;
+static latency_profile_t dma_profile;
+
+/*
+ * Decoders don't write to the output themselves. Each source has a PCM
+ * ring that render_source_samples() fills with blocks of interleaved stereo
+ * frames in the native format. The renderer task mixes what the sources
+ * have, converts it for the output and sleeps in the driver until DMA has
+ * room. A decoder only waits when its ring is full, so it can decode ahead
+ * in bursts.
+ */
+static TaskHandle_t renderer_task_handle;
+static SemaphoreHandle_t renderer_task_exited;
+
+/* precedes every block in a PCM ring */
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t len;
+    uint32_t enqueued_ms;
+    uint32_t generation;
+    uint32_t stream;
+} pcm_block_t;
+
+/*
+ * Samples in the rings and the mixer are 16 bit, or 32 bit if I2S runs at
+ * 32 bit and the output takes them as they are. Decoders that ask with
+ * renderer_get_format() deliver that, the rest is converted on the way in.
+ */
+static i2s_bits_per_sample_t native_depth;
+static uint32_t frame_bytes;
+
+/* largest block, fifo_peek_contiguous() must return it in one piece */
+#define PCM_BLOCK_BYTES (PCM_BLOCK_FRAMES * PCM_MAX_FRAME_BYTES)
 
-static void init_i2s(renderer_config_t *config)
+#if FIFO_MIRROR_SIZE < PCM_BLOCK_BYTES
+#error "FIFO mirror region can't hold a whole PCM block"
+#endif
+
+typedef struct
 {
-    i2s_mode_t mode = I2S_MODE_MASTER | I2S_MODE_TX;
-    i2s_comm_format_t comm_fmt = I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB;
+    fifo_t *ring;
+    /* only with a fixed output rate, the I2S clock never changes then */
+    resampler_t *resampler;
+    /* frames on their way into the ring, one producer per source */
+    uint32_t stage[PCM_BLOCK_BYTES / sizeof(uint32_t)];
 
-    if(config->output_mode == DAC_BUILT_IN)
-    {
-        mode = mode | I2S_MODE_DAC_BUILT_IN;
-        comm_fmt = I2S_COMM_FORMAT_I2S_MSB;
+    /* the block the renderer task is playing */
+    uint32_t block_rate;
+    uint32_t block_left;
+    uint32_t block_enqueued_ms;
+    uint32_t block_generation;
+    uint32_t block_stream;
+
+    /* renderer_flush() moves on to the next generation, blocks of older
+     * ones are faded out and dropped */
+    volatile uint32_t generation;
+
+    /* renderer_pause(), the source fades out and its frames wait in the ring */
+    volatile bool paused;
+
+    /* renderer_start_stream() tags the blocks queued from then on */
+    volatile uint32_t stream;
+
+    /* frames of the stream playing that went to the sink, and the total of
+     * the one before it. Read without locking by the position queries. */
+    volatile uint32_t played_stream;
+    volatile uint32_t played_frames;
+    volatile uint32_t played_rate;
+    volatile uint32_t finished_stream;
+    volatile uint32_t finished_ms;
+
+    /* Q15, set by the user and where the ramp towards it is */
+    volatile int32_t gain;
+    int32_t ramp_gain;
+    TickType_t active_until;
+} mixer_source_t;
+
+static mixer_source_t sources[RENDERER_SOURCE_COUNT];
+
+/* owned by the renderer task */
+static int32_t mix_acc[PCM_BLOCK_FRAMES * 2];
+static int32_t mix_buf[PCM_BLOCK_FRAMES * 2];
+static uint32_t output_buf[PCM_BLOCK_BYTES / sizeof(uint32_t)];
+static pcm_converter_t output_conv;
+static bool output_passthrough;
+
+/*
+ * Envelope of the whole output. Playback fades in from silence, and before
+ * it stops, the output eases from its last frame down to silence. Without
+ * that, starting and stopping DMA cuts the waveform and the speaker pops.
+ */
+static int32_t fade_gain;
+static int32_t last_frame[2];
+
+/* only the renderer task starts and stops the sink */
+static bool sink_running;
+
+/*
+ * The driver's interrupt posts an I2S_EVENT_TX_DONE for every DMA buffer
+ * sent. The renderer task collects them once per block and compares them
+ * with what it wrote: a buffer sent without fresh samples is a DMA
+ * underflow, the driver sends stale data then.
+ */
+static int32_t dma_fresh_buffers;
+static uint32_t dma_partial_frames;
+static bool dma_idle = true;        /* DMA holds silence, starving is fine */
+static bool dma_starved;
+static uint32_t dma_starved_ms;
+
+static renderer_stats_t stats;
+
+/*
+ * Volume and mute of the whole output. In software they scale the target
+ * gain of every source, so the mixer ramps them like any gain change. A
+ * sink with a volume of its own applies them, volume_gain stays at unity
+ * then.
+ */
+static uint8_t renderer_volume = RENDERER_VOLUME_MAX;
+static bool renderer_muted;
+static volatile int32_t volume_gain = MIXER_GAIN_UNITY;
+
+/* upper bounds of the latency buckets, the last one takes the rest */
+static const uint32_t latency_bounds_ms[RENDERER_LATENCY_BUCKETS - 1] = {
+    5, 10, 20, 50, 100, 200, 500
+};
+
+/* with a fixed output rate the resampler applies the modifier */
+static uint32_t output_rate(renderer_config_t *config)
+{
+    if (config->output_sample_rate != 0)
+        return config->sample_rate;
+
+    return config->sample_rate * config->sample_rate_modifier;
+}
+
+static int open_sink(renderer_config_t *config, latency_profile_t profile)
+{
+    const dma_profile_t *dma = &dma_profiles[profile];
+    int ret = 0;
+
+    sink_events = NULL;
+    if (sink->open(config, output_rate(config), dma->dma_buf_count, dma->dma_buf_len, &sink_events) != 0) {
+        ESP_LOGE(TAG, "can't open the %s sink", sink->name);
+        ret = -1;
     }
 
-    if(config->output_mode == PDM)
-    {
-        mode = mode | I2S_MODE_PDM;
-    }
-
-    /*
-     * Allocate just enough to decode AAC+, which has huge frame sizes.
-     *
-     * Memory consumption formula:
-     * (bits_per_sample / 8) * num_chan * dma_buf_count * dma_buf_len
-     *
-     * 16 bit: 32 * 256 = 8192 bytes
-     * 32 bit: 32 * 256 = 16384 bytes
-     */
-    i2s_config_t i2s_config = {
-            .mode = mode,          // Only TX
-            .sample_rate = config->sample_rate,
-            .bits_per_sample = config->bit_depth,
-            .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,   // 2-channels
-            .communication_format = comm_fmt,
-            .dma_buf_count = 32,                            // number of buffers, 128 max.
-            .dma_buf_len = 64,                          // size of each buffer
-            .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1        // Interrupt level 1
-    };
+    dma_profile = profile;
+    dma_fresh_buffers = 0;
+    dma_partial_frames = 0;
+    dma_idle = true;
 
-    i2s_pin_config_t pin_config = {
-            .bck_io_num = GPIO_NUM_26,
-            .ws_io_num = GPIO_NUM_25,
-            .data_out_num = GPIO_NUM_22,
-            .data_in_num = I2S_PIN_NO_CHANGE
-    };
+    return ret;
+}
 
-    i2s_driver_install(config->i2s_num, &i2s_config, 1, &i2s_event_queue);
+static void dma_zero(renderer_config_t *config)
+{
+    sink->zero(config);
+    dma_fresh_buffers = 0;
+    dma_partial_frames = 0;
+    dma_idle = true;
+}
 
-    if((mode & I2S_MODE_DAC_BUILT_IN) || (mode & I2S_MODE_PDM))
-    {
-        i2s_set_pin(config->i2s_num, NULL);
-        i2s_set_dac_mode(I2S_DAC_CHANNEL_BOTH_EN);
+static void dma_collect_events()
+{
+    i2s_event_t evt;
+
+    if (sink_events == NULL)
+        return;
+
+    while (xQueueReceive(sink_events, &evt, 0) == pdTRUE) {
+        if (evt.type != I2S_EVENT_TX_DONE)
+            continue;
+
+        stats.dma_buffers_sent++;
+        if (dma_fresh_buffers > 0) {
+            dma_fresh_buffers--;
+        } else if (!dma_idle) {
+            stats.dma_buffers_starved++;
+            if (!dma_starved) {
+                dma_starved = true;
+                dma_starved_ms = esp_log_timestamp();
+            }
+        }
+    }
+}
+
+static void dma_written(uint32_t frames, bool samples)
+{
+    const dma_profile_t *dma = &dma_profiles[dma_profile];
+
+    // without a clock nothing stays in flight, DMA counts as idle
+    if (!sink->clocked)
+        return;
+
+    dma_partial_frames += frames;
+    dma_fresh_buffers += dma_partial_frames / dma->dma_buf_len;
+    dma_partial_frames %= dma->dma_buf_len;
+    dma_idle = false;
+
+    if (samples && dma_starved) {
+        uint32_t now_ms = esp_log_timestamp();
+        if (now_ms - dma_starved_ms < RENDERER_UNDERRUN_GAP_MS) {
+            stats.underruns++;
+            stats.last_underrun_ms = now_ms;
+            ESP_LOGW(TAG, "DMA underrun, %u ms without samples", now_ms - dma_starved_ms);
+        }
+        dma_starved = false;
+    }
+}
+
+/* time from render_source_samples() to the driver taking the block */
+static void record_latency(renderer_source_t id, uint32_t ms)
+{
+    int bucket = 0;
+    while (bucket < RENDERER_LATENCY_BUCKETS - 1 && ms >= latency_bounds_ms[bucket])
+        bucket++;
+
+    stats.latency_hist[id][bucket]++;
+    stats.blocks[id]++;
+    stats.latency_max_ms[id] = max(stats.latency_max_ms[id], ms);
+}
+
+static void set_sample_rate(renderer_config_t *config, uint32_t sample_rate)
+{
+    ESP_LOGI(TAG, "changing sample rate from %d to %d", config->sample_rate, sample_rate);
+    config->sample_rate = sample_rate;
+    sink->set_sample_rate(config, output_rate(config));
+}
+
+/* until only the DMA buffer now playing holds fresh samples */
+static TickType_t dma_slack_ticks(renderer_config_t *config)
+{
+    const dma_profile_t *dma = &dma_profiles[dma_profile];
+    uint32_t frames = dma_fresh_buffers * dma->dma_buf_len + dma_partial_frames;
+
+    if (frames <= dma->dma_buf_len)
+        return 0;
+
+    return pdMS_TO_TICKS((frames - dma->dma_buf_len) * 1000 / config->sample_rate);
+}
+
+/* convert native frames for the output and hand them to DMA */
+static void output_frames(renderer_config_t *config, const void *pcm, uint32_t frames, bool samples)
+{
+    const char *data = pcm;
+    int bytes_left = frames * frame_bytes;
+
+    if (!output_passthrough) {
+        output_conv.convert(data, data + frame_bytes / 2, output_buf, frames);
+        data = (const char *) output_buf;
+        bytes_left = frames * output_conv.out_frame_bytes;
+    }
+
+    // the driver sleeps until a DMA buffer has been sent
+    while (bytes_left > 0 && sink_running) {
+        int bytes_written = sink->write(config, data, bytes_left, RENDERER_POLL_TICKS);
+        bytes_left -= bytes_written;
+        data += bytes_written;
+
+        // stop() or destroy() while DMA is full
+        if (bytes_written == 0 && renderer_status != RUNNING)
+            break;
+    }
+
+    dma_written(frames, samples);
+}
+
+/* Ease the output from its last frame down to silence. One more DMA buffer
+ * of silence follows, DMA can be zeroed while it plays. */
+static void play_tail(renderer_config_t *config)
+{
+    const dma_profile_t *dma = &dma_profiles[dma_profile];
+
+    while (fade_gain > 0) {
+        uint32_t frames = min(PCM_BLOCK_FRAMES, (fade_gain + MIXER_FADE_STEP - 1) / MIXER_FADE_STEP);
+        if (native_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+            for (uint32_t i = 0; i < frames; i++) {
+                mix_buf[2 * i] = last_frame[0];
+                mix_buf[2 * i + 1] = last_frame[1];
+            }
+            mixer_fade_32(mix_buf, frames, &fade_gain, 0);
+        } else {
+            int16_t *pcm = (int16_t *) mix_buf;
+            for (uint32_t i = 0; i < frames; i++) {
+                pcm[2 * i] = last_frame[0];
+                pcm[2 * i + 1] = last_frame[1];
+            }
+            mixer_fade(pcm, frames, &fade_gain, 0);
+        }
+        output_frames(config, mix_buf, frames, false);
+    }
+
+    last_frame[0] = 0;
+    last_frame[1] = 0;
+
+    memset(mix_buf, 0, sizeof(mix_buf));
+    uint32_t pad = 2 * dma->dma_buf_len - dma_partial_frames;
+    while (pad > 0) {
+        uint32_t frames = min(pad, PCM_BLOCK_FRAMES);
+        output_frames(config, mix_buf, frames, false);
+        pad -= frames;
+    }
+}
+
+/* fade out and let DMA play out, before its clock or its buffers change */
+static void dma_drain(renderer_config_t *config)
+{
+    if (dma_idle || !sink_running)
+        return;
+
+    play_tail(config);
+    dma_collect_events();
+    vTaskDelay(dma_slack_ticks(config));
+    dma_zero(config);
+}
+
+/* DMA can only be resized by reinstalling the driver */
+static void set_dma_profile(renderer_config_t *config, latency_profile_t profile)
+{
+    ESP_LOGI(TAG, "changing latency profile from %d to %d", dma_profile, profile);
+    dma_drain(config);
+    sink->close(config);
+    open_sink(config, profile);
+
+    if (sink_running) {
+        sink->start(config);
+    }
+}
+
+/* frames of the current block in the ring, starts the next block if needed */
+static uint32_t source_frames(mixer_source_t *src)
+{
+    if (src->block_left == 0) {
+        if (fifo_fill(src->ring) < sizeof(pcm_block_t))
+            return 0;
+
+        pcm_block_t block;
+        fifo_read(src->ring, (char *) &block, sizeof(block));
+        src->block_rate = block.sample_rate;
+        src->block_left = block.len;
+        src->block_enqueued_ms = block.enqueued_ms;
+        src->block_generation = block.generation;
+        src->block_stream = block.stream;
+    }
+
+    return min(src->block_left, fifo_fill(src->ring)) / frame_bytes;
+}
+
+static void source_consume(mixer_source_t *src, uint32_t frames)
+{
+    fifo_consume(src->ring, frames * frame_bytes);
+    src->block_left -= frames * frame_bytes;
+}
+
+static bool source_stale(mixer_source_t *src)
+{
+    return src->block_generation != src->generation;
+}
+
+static bool source_active(mixer_source_t *src, TickType_t now)
+{
+    return (int32_t) (src->active_until - now) > 0;
+}
+
+/* the dialog pushes content down, the ramps make it fade rather than jump */
+static int32_t source_target_gain(renderer_source_t id, TickType_t now)
+{
+    int32_t gain = (sources[id].gain * volume_gain) >> 15;
+
+    if (source_stale(&sources[id]) || sources[id].paused)
+        return 0;
+
+    if (id == RENDERER_SOURCE_CONTENT && source_active(&sources[RENDERER_SOURCE_DIALOG], now)) {
+        gain = (gain * RENDERER_DUCK_GAIN) >> 15;
+    }
+
+    return gain;
+}
+
+/* A block of another stream ends the one counted so far. The fields are
+ * written in the order the position queries need them. */
+static void count_played(mixer_source_t *src, uint32_t frames)
+{
+    if (src->block_stream != src->played_stream) {
+        if (src->played_rate > 0) {
+            src->finished_ms = (uint64_t) src->played_frames * 1000 / src->played_rate;
+        }
+        src->finished_stream = src->played_stream;
+        src->played_frames = 0;
+        src->played_rate = src->block_rate;
+        src->played_stream = src->block_stream;
+    }
+
+    src->played_frames += frames;
+}
+
+/* nothing is played while stopped, queued frames are dropped but those of a
+ * paused source, they are still to be heard. Flushed ones go all the same. */
+static void drop_sources()
+{
+    for (int i = 0; i < RENDERER_SOURCE_COUNT; i++) {
+        mixer_source_t *src = &sources[i];
+        uint32_t frames;
+
+        while ((frames = source_frames(src)) > 0 && (!src->paused || source_stale(src))) {
+            source_consume(src, frames);
+        }
+    }
+}
+
+/* sum the playing sources into mix_buf and apply the output envelope */
+static void mix_sources(mixer_source_t **playing, const uint32_t *avail, const int32_t *target,
+        int count, uint32_t frames)
+{
+    memset(mix_acc, 0, frames * 2 * sizeof(int32_t));
+
+    for (int i = 0; i < count; i++) {
+        int len;
+        const char *in = fifo_peek_contiguous(playing[i]->ring, &len);
+        if (native_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+            mixer_accumulate_32(mix_acc, (const int32_t *) in, avail[i], &playing[i]->ramp_gain, target[i]);
+        } else {
+            mixer_accumulate(mix_acc, (const int16_t *) in, avail[i], &playing[i]->ramp_gain, target[i]);
+        }
+    }
+
+    if (native_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+        mixer_saturate_32(mix_acc, mix_buf, frames);
+        mixer_fade_32(mix_buf, frames, &fade_gain, MIXER_GAIN_UNITY);
+    } else {
+        mixer_saturate(mix_acc, (int16_t *) mix_buf, frames);
+        mixer_fade((int16_t *) mix_buf, frames, &fade_gain, MIXER_GAIN_UNITY);
     }
-    else {
-        i2s_set_pin(config->i2s_num, &pin_config);
+}
+
+/* the tail fades out from here */
+static void keep_last_frame(const void *pcm, uint32_t frames)
+{
+    if (native_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+        const int32_t *last = (const int32_t *) pcm + 2 * (frames - 1);
+        last_frame[0] = last[0];
+        last_frame[1] = last[1];
+    } else {
+        const int16_t *last = (const int16_t *) pcm + 2 * (frames - 1);
+        last_frame[0] = last[0];
+        last_frame[1] = last[1];
+    }
+}
+
+static void renderer_task(void *pvParameters)
+{
+    renderer_config_t *config = pvParameters;
+
+    pcm_format_t native;
+    renderer_get_format(&native);
+
+    if (pcm_converter_init(&output_conv, &native, config->output_mode, config->bit_depth) != 0) {
+        ESP_LOGE(TAG, "unsupported output: %d bit, output mode %d", config->bit_depth, config->output_mode);
     }
 
-    i2s_stop(config->i2s_num);
+    // the ring already holds what an I2S frame looks like
+    output_passthrough = config->bit_depth == native_depth
+            && config->output_mode != DAC_BUILT_IN;
+
+    while (renderer_status != UNINITIALIZED) {
+
+        // hold on to the data until the renderer is started
+        if (renderer_status == INITIALIZED) {
+            ulTaskNotifyTake(pdTRUE, RENDERER_POLL_TICKS);
+            continue;
+        }
+
+        if (renderer_status == STOPPED) {
+            if (sink_running) {
+                dma_drain(config);
+                sink->stop(config);
+                sink_running = false;
+            }
+            drop_sources();
+            ulTaskNotifyTake(pdTRUE, RENDERER_POLL_TICKS);
+            continue;
+        }
+
+        if (!sink_running) {
+            // DMA isn't running, this can't be heard. What it held might be noise.
+            dma_zero(config);
+            sink->start(config);
+            sink_running = true;
+            // without a clock there is nothing to pop, frames go out as they are
+            fade_gain = sink->clocked ? 0 : MIXER_GAIN_UNITY;
+        }
+
+        dma_collect_events();
+
+        TickType_t now = xTaskGetTickCount();
+
+        // The dialog goes first. If the I2S clock follows the streams, a
+        // source at another rate waits until the one playing is done.
+        mixer_source_t *playing[RENDERER_SOURCE_COUNT];
+        uint32_t avail[RENDERER_SOURCE_COUNT];
+        int32_t target[RENDERER_SOURCE_COUNT];
+        int count = 0;
+        uint32_t rate = 0;
+        uint32_t frames = 0;
+
+        for (int i = RENDERER_SOURCE_COUNT - 1; i >= 0; i--) {
+            mixer_source_t *src = &sources[i];
+            uint32_t n;
+
+            // flushed blocks go once they are faded out
+            while ((n = source_frames(src)) > 0 && source_stale(src) && src->ramp_gain == 0) {
+                source_consume(src, n);
+            }
+
+            if (n == 0)
+                continue;
+
+            // held once it is faded out
+            if (src->paused && src->ramp_gain == 0)
+                continue;
+
+            if (count == 0)
+                rate = src->block_rate;
+            else if (src->block_rate != rate)
+                continue;
+
+            src->active_until = now + RENDERER_DUCK_HOLD_TICKS;
+            playing[count] = src;
+            avail[count] = min(n, PCM_BLOCK_FRAMES);
+            frames = max(frames, avail[count]);
+            count++;
+        }
+
+        if (count == 0) {
+            if (dma_idle) {
+                ulTaskNotifyTake(pdTRUE, RENDERER_POLL_TICKS);
+            } else if (fade_gain > 0) {
+                // the producer may still catch up before DMA runs dry
+                if (ulTaskNotifyTake(pdTRUE, dma_slack_ticks(config)) == 0) {
+                    play_tail(config);
+                }
+            } else {
+                // DMA would keep repeating the last buffers after the tail
+                if (ulTaskNotifyTake(pdTRUE, dma_slack_ticks(config)) == 0) {
+                    dma_collect_events();
+                    dma_zero(config);
+                }
+            }
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            target[i] = source_target_gain(playing[i] - sources, now);
+        }
+
+        // the dialog wants to be heard now, content gets its own depth back
+        // once the dialog is over
+        latency_profile_t profile = config->latency;
+        if (source_active(&sources[RENDERER_SOURCE_DIALOG], now))
+            profile = LATENCY_LOW;
+
+        if (profile != dma_profile && sink->clocked) {
+            set_dma_profile(config, profile);
+        }
+
+        if (rate != config->sample_rate) {
+            dma_drain(config);
+            set_sample_rate(config, rate);
+        }
+
+        // a single source at unity gain is played straight from its ring
+        const void *pcm;
+        if (count == 1 && target[0] == MIXER_GAIN_UNITY
+                && playing[0]->ramp_gain == MIXER_GAIN_UNITY
+                && fade_gain == MIXER_GAIN_UNITY) {
+            int len;
+            pcm = fifo_peek_contiguous(playing[0]->ring, &len);
+        } else {
+            mix_sources(playing, avail, target, count, frames);
+            pcm = mix_buf;
+        }
+
+        keep_last_frame(pcm, frames);
+
+        output_frames(config, pcm, frames, true);
+
+        uint32_t now_ms = esp_log_timestamp();
+        for (int i = 0; i < count; i++) {
+            if (playing[i]->block_left == avail[i] * frame_bytes) {
+                record_latency(playing[i] - sources, now_ms - playing[i]->block_enqueued_ms);
+            }
+            count_played(playing[i], avail[i]);
+            source_consume(playing[i], avail[i]);
+        }
+    }
+
+    xSemaphoreGive(renderer_task_exited);
+    vTaskDelete(NULL);
+}
+
+/* queue len bytes of native frames, blocks while the ring is full */
+static void enqueue_block(mixer_source_t *src, const void *buf, uint32_t len, uint32_t sample_rate)
+{
+    pcm_block_t block = {
+        .sample_rate = sample_rate,
+        .len = len,
+        .enqueued_ms = esp_log_timestamp(),
+        .generation = src->generation,
+        .stream = src->stream
+    };
+
+    fifo_write(src->ring, (const char *) &block, sizeof(block));
+    fifo_write(src->ring, (const char *) buf, len);
+    xTaskNotifyGive(renderer_task_handle);
+}
+
+/* bring the stream to the output rate, then queue it */
+static void resample_samples(mixer_source_t *src, const int16_t *ptr_l, const int16_t *ptr_r,
+        uint8_t in_stride, uint32_t frames, pcm_format_t *buf_desc)
+{
+    uint32_t out_rate = renderer_instance->output_sample_rate;
+
+    if (resampler_set_rates(src->resampler, buf_desc->sample_rate, out_rate,
+            renderer_instance->sample_rate_modifier) != 0)
+        return;
+
+    size_t frames_left = frames;
+    for (;;) {
+        size_t taken = frames_left;
+        size_t produced = resampler_process(src->resampler, ptr_l, ptr_r, in_stride,
+                &taken, (int16_t *) src->stage, PCM_BLOCK_FRAMES);
+
+        ptr_l += taken * in_stride;
+        ptr_r += taken * in_stride;
+        frames_left -= taken;
+
+        if (produced == 0)
+            break;
+
+        enqueue_block(src, src->stage, produced * frame_bytes, out_rate);
+    }
 }
 
 /**
@@ -90,135 +725,236 @@ static void init_i2s(renderer_config_t *config)
  *
  * ESP32 is little-endian.
  */
-void render_samples(char *buf, uint32_t buf_len, pcm_format_t *buf_desc)
+void render_source_samples(renderer_source_t source, char *buf, uint32_t buf_len, pcm_format_t *buf_desc)
 {
     //ESP_LOGI(TAG, "buf_desc: bit_depth %d format %d num_chan %d sample_rate %d", buf_desc->bit_depth, buf_desc->buffer_format, buf_desc->num_channels, buf_desc->sample_rate);
-    //ESP_LOGI(TAG, "renderer_instance: bit_depth %d, output_mode %d", renderer_instance->bit_depth, renderer_instance->output_mode);
 
-    // handle changed sample rate
-    if(renderer_instance->sample_rate != buf_desc->sample_rate)
-    {
-        ESP_LOGI(TAG, "changing sample rate from %d to %d", renderer_instance->sample_rate, buf_desc->sample_rate);
-        uint32_t rate = buf_desc->sample_rate * renderer_instance->sample_rate_modifier;
-        // uint32_t rate = buf_desc->sample_rate;
-        i2s_set_sample_rates(renderer_instance->i2s_num, rate);
-        renderer_instance->sample_rate = buf_desc->sample_rate;
-    }
+    if (renderer_status == STOPPED)
+        return;
 
+    mixer_source_t *src = &sources[source];
     uint8_t buf_bytes_per_sample = (buf_desc->bit_depth / 8);
     uint32_t num_samples = buf_len / buf_bytes_per_sample / buf_desc->num_channels;
 
-    // formats match, we can write the whole block
-    if (buf_desc->bit_depth == renderer_instance->bit_depth
+    // native frames go into the ring as they are
+    if (src->resampler == NULL
+            && buf_desc->bit_depth == native_depth
             && buf_desc->buffer_format == PCM_INTERLEAVED
-            && buf_desc->num_channels == 2
-            && renderer_instance->output_mode != DAC_BUILT_IN) {
-
-        // do not wait longer than the duration of the buffer
-        TickType_t max_wait = buf_desc->sample_rate / num_samples / 2;
-
-        // don't block, rather retry
-        int bytes_left = buf_len;
-        int bytes_written = 0;
-        while(bytes_left > 0) {
-            bytes_written = i2s_write_bytes(renderer_instance->i2s_num, buf, bytes_left, 0);
-            bytes_left -= bytes_written;
-            buf += bytes_written;
+            && buf_desc->num_channels == 2) {
+
+        while (buf_len > 0) {
+            uint32_t len = min(buf_len, PCM_BLOCK_FRAMES * frame_bytes);
+            enqueue_block(src, buf, len, buf_desc->sample_rate);
+            buf += len;
+            buf_len -= len;
         }
 
         return;
     }
 
-    // support only 16 bit buffers for now
-    if(buf_desc->bit_depth != I2S_BITS_PER_SAMPLE_16BIT) {
-        ESP_LOGE(TAG, "unsupported decoder bit depth: %d", buf_desc->bit_depth);
+    // interleaving is the I2S conversion at the native depth
+    pcm_converter_t conv;
+    if(pcm_converter_init(&conv, buf_desc, I2S, native_depth) != 0) {
+        ESP_LOGE(TAG, "unsupported input: %d bit, %d channels", buf_desc->bit_depth, buf_desc->num_channels);
         return;
     }
 
     // pointer to left / right sample position
-    char *ptr_l = buf;
-    char *ptr_r = buf + buf_bytes_per_sample;
-    uint8_t stride = buf_bytes_per_sample * 2;
+    const char *ptr_l = buf;
+    const char *ptr_r = ptr_l + buf_bytes_per_sample;
 
     // right half of the buffer contains all the right channel samples
     if(buf_desc->buffer_format == PCM_LEFT_RIGHT)
     {
         ptr_r = buf + buf_len / 2;
-        stride = buf_bytes_per_sample;
     }
 
     if (buf_desc->num_channels == 1) {
         ptr_r = ptr_l;
     }
 
-    int bytes_pushed = 0;
-    for (int i = 0; i < num_samples; i++) {
-        if (renderer_status == STOPPED) break;
+    uint32_t in_frame_bytes = conv.in_stride * conv.in_sample_bytes;
 
-        if(renderer_instance->output_mode == DAC_BUILT_IN)
-        {
-            // assume 16 bit src bit_depth
-            short left = *(short *) ptr_l;
-            short right = *(short *) ptr_r;
+    if (src->resampler != NULL) {
+        // the resampler takes 16 bit, renderer_get_format() says so
+        if (buf_desc->bit_depth != I2S_BITS_PER_SAMPLE_16BIT) {
+            ESP_LOGE(TAG, "can't resample %d bit input", buf_desc->bit_depth);
+            return;
+        }
+        resample_samples(src, (const int16_t *) ptr_l, (const int16_t *) ptr_r,
+                conv.in_stride, num_samples, buf_desc);
+        return;
+    }
 
-            // The built-in DAC wants unsigned samples, so we shift the range
-            // from -32768-32767 to 0-65535.
-            left = left + 0x8000;
-            right = right + 0x8000;
+    // convert a block, then queue it in one piece
+    uint32_t frames_left = num_samples;
+    while (frames_left > 0) {
+        uint32_t frames = min(frames_left, PCM_BLOCK_FRAMES);
+        conv.convert(ptr_l, ptr_r, src->stage, frames);
+        enqueue_block(src, src->stage, frames * frame_bytes, buf_desc->sample_rate);
 
-            uint32_t sample = (uint16_t) left;
-            sample = (sample << 16 & 0xffff0000) | ((uint16_t) right);
+        ptr_l += frames * in_frame_bytes;
+        ptr_r += frames * in_frame_bytes;
+        frames_left -= frames;
+    }
+}
 
-            bytes_pushed = i2s_push_sample(renderer_instance->i2s_num, (const char*) &sample, portMAX_DELAY);
-        }
-        else {
+void render_samples(char *buf, uint32_t buf_len, pcm_format_t *buf_desc)
+{
+    render_source_samples(RENDERER_SOURCE_CONTENT, buf, buf_len, buf_desc);
+}
 
-            switch (renderer_instance->bit_depth)
-            {
-                case I2S_BITS_PER_SAMPLE_16BIT:
-                    ; // workaround
+void renderer_set_gain(renderer_source_t source, int32_t gain)
+{
+    sources[source].gain = gain;
+}
 
-                    /* low - high / low - high */
-                    const char samp32[4] = {ptr_l[0], ptr_l[1], ptr_r[0], ptr_r[1]};
+static void apply_volume()
+{
+    bool silent = renderer_muted || renderer_volume == 0;
 
-                    bytes_pushed = i2s_push_sample(renderer_instance->i2s_num, (const char*) &samp32, portMAX_DELAY);
-                    break;
+    // in 1/4 dB below full scale
+    uint32_t attenuation = (RENDERER_VOLUME_MAX - renderer_volume)
+            * RENDERER_VOLUME_RANGE_DB * 4 / RENDERER_VOLUME_MAX;
 
-                case I2S_BITS_PER_SAMPLE_32BIT:
-                    ; // workaround
+    if (sink != NULL && sink->set_volume != NULL
+            && sink->set_volume(renderer_instance, attenuation, silent) == 0) {
+        volume_gain = MIXER_GAIN_UNITY;
+        return;
+    }
 
-                    const char samp64[8] = {0, 0, ptr_l[0], ptr_l[1], 0, 0, ptr_r[0], ptr_r[1]};
-                    bytes_pushed = i2s_push_sample(renderer_instance->i2s_num, (const char*) &samp64, portMAX_DELAY);
-                    break;
+    if (silent) {
+        volume_gain = 0;
+    } else {
+        volume_gain = MIXER_GAIN_UNITY * powf(10.0f, attenuation / -80.0f) + 0.5f;
+    }
+}
 
-                default:
-                    ESP_LOGE(TAG, "bit depth unsupported: %d", renderer_instance->bit_depth);
-            }
-        }
+void renderer_set_volume(uint8_t volume)
+{
+    renderer_volume = min(volume, RENDERER_VOLUME_MAX);
+    apply_volume();
+}
 
-        // DMA buffer full - retry
-        if (bytes_pushed == 0) {
-            i--;
-        } else {
-            ptr_r += stride;
-            ptr_l += stride;
-        }
-    }
+uint8_t renderer_get_volume()
+{
+    return renderer_volume;
+}
+
+void renderer_set_mute(bool mute)
+{
+    renderer_muted = mute;
+    apply_volume();
+}
+
+bool renderer_get_mute()
+{
+    return renderer_muted;
+}
+
+void renderer_set_latency(latency_profile_t profile)
+{
+    renderer_instance->latency = profile;
+}
+
+uint32_t renderer_get_output_latency_ms(renderer_source_t source)
+{
+    if (renderer_status == UNINITIALIZED)
+        return 0;
+
+    const dma_profile_t *dma = &dma_profiles[dma_profile];
+    uint32_t frames = dma->dma_buf_count * dma->dma_buf_len
+            + fifo_fill(sources[source].ring) / frame_bytes;
+
+    return frames * 1000 / renderer_instance->sample_rate;
+}
+
+uint32_t renderer_start_stream(renderer_source_t source)
+{
+    // 0 tags whatever was queued before the first stream
+    if (++sources[source].stream == 0)
+        sources[source].stream = 1;
+
+    return sources[source].stream;
+}
+
+uint32_t renderer_get_stream_position_ms(renderer_source_t source, uint32_t stream)
+{
+    mixer_source_t *src = &sources[source];
+
+    if (renderer_status == UNINITIALIZED || stream == 0)
+        return 0;
+
+    if (stream == src->finished_stream)
+        return src->finished_ms;
+
+    uint32_t rate = src->played_rate;
+    uint32_t frames = src->played_frames;
+    if (stream != src->played_stream || rate == 0)
+        return 0;
+
+    // what DMA still holds hasn't been heard
+    const dma_profile_t *dma = &dma_profiles[dma_profile];
+    int32_t in_dma = dma_fresh_buffers * dma->dma_buf_len + dma_partial_frames;
+    if (in_dma > 0)
+        frames = frames > (uint32_t) in_dma ? frames - in_dma : 0;
+
+    return (uint64_t) frames * 1000 / rate;
+}
+
+void renderer_get_stats(renderer_stats_t *out)
+{
+    memcpy(out, &stats, sizeof(renderer_stats_t));
+}
+
+void renderer_reset_stats()
+{
+    memset(&stats, 0, sizeof(renderer_stats_t));
+    stats.since = esp_log_timestamp();
+}
+
+void renderer_dump_stats()
+{
+    renderer_stats_t s;
+    renderer_get_stats(&s);
+
+    ESP_LOGI(TAG, "%u ms: %u DMA buffers sent, %u starved, %u underruns, last at %u ms",
+            esp_log_timestamp() - s.since, s.dma_buffers_sent, s.dma_buffers_starved,
+            s.underruns, s.last_underrun_ms);
 
-    /* takes too long
-    i2s_event_t evt = {0};
-    if(xQueueReceive(i2s_event_queue, &evt, 0)) {
-        if(evt.type == I2S_EVENT_TX_DONE) {
-            ESP_LOGE(TAG, "DMA Buffer Underflow");
+    for (int id = 0; id < RENDERER_SOURCE_COUNT; id++) {
+        if (s.blocks[id] == 0)
+            continue;
+
+        ESP_LOGI(TAG, "source %d: %u blocks, latency max %u ms", id, s.blocks[id], s.latency_max_ms[id]);
+        for (int i = 0; i < RENDERER_LATENCY_BUCKETS; i++) {
+            uint32_t lower = (i > 0) ? latency_bounds_ms[i - 1] : 0;
+            if (i < RENDERER_LATENCY_BUCKETS - 1) {
+                ESP_LOGI(TAG, "source %d: %3u-%3u ms: %3u%% (%u)", id, lower, latency_bounds_ms[i],
+                        s.latency_hist[id][i] * 100 / s.blocks[id], s.latency_hist[id][i]);
+            } else {
+                ESP_LOGI(TAG, "source %d: %3u+    ms: %3u%% (%u)", id, lower,
+                        s.latency_hist[id][i] * 100 / s.blocks[id], s.latency_hist[id][i]);
+            }
         }
     }
-    */
 }
 
 
-void renderer_zero_dma_buffer()
+/* what is queued for source now fades out and is dropped */
+void renderer_flush(renderer_source_t source)
+{
+    sources[source].generation++;
+    xTaskNotifyGive(renderer_task_handle);
+}
+
+void renderer_pause(renderer_source_t source, bool pause)
 {
-    i2s_zero_dma_buffer(renderer_instance->i2s_num);
+    if (sources[source].paused == pause)
+        return;
+
+    sources[source].paused = pause;
+    xTaskNotifyGive(renderer_task_handle);
 }
 
 
@@ -227,6 +963,14 @@ renderer_config_t *renderer_get()
     return renderer_instance;
 }
 
+void renderer_get_format(pcm_format_t *format)
+{
+    format->bit_depth = native_depth;
+    format->num_channels = 2;
+    format->buffer_format = PCM_INTERLEAVED;
+    format->endianness = PCM_LITTLE_ENDIAN;
+}
+
 
 /* init renderer sink */
 void renderer_init(renderer_config_t *config)
@@ -234,12 +978,57 @@ void renderer_init(renderer_config_t *config)
     // update global
     renderer_instance = config;
     renderer_status = INITIALIZED;
+    sink = config->sink;
+    sink_running = false;
+    fade_gain = 0;
 
-    ESP_LOGI(TAG, "init I2S mode %d, port %d, %d bit, %d Hz", config->output_mode, config->i2s_num, config->bit_depth, config->sample_rate);
-    init_i2s(config);
+    // I2S runs at the output rate for good, streams are resampled to it
+    if (config->output_sample_rate != 0) {
+        config->sample_rate = config->output_sample_rate;
+    }
+
+    // the DAC and the resampler only take 16 bit
+    native_depth = I2S_BITS_PER_SAMPLE_16BIT;
+    if (config->bit_depth == I2S_BITS_PER_SAMPLE_32BIT
+            && config->output_mode != DAC_BUILT_IN
+            && config->output_sample_rate == 0) {
+        native_depth = I2S_BITS_PER_SAMPLE_32BIT;
+    }
+    frame_bytes = 2 * (native_depth / 8);
+
+    if (sink == NULL) {
+        ESP_LOGE(TAG, "no sink configured");
+        abort();
+    }
 
-    if(config->output_mode == I2S_MERUS) {
-        init_ma120(0x50); // setup ma120x0p and initial volume
+    ESP_LOGI(TAG, "init %s sink, I2S mode %d, port %d, %d bit, %d Hz", sink->name,
+            config->output_mode, config->i2s_num, config->bit_depth, config->sample_rate);
+
+    // a player without output would look like it works
+    if (open_sink(config, config->latency) != 0) {
+        abort();
+    }
+
+    apply_volume();
+
+    for (int i = 0; i < RENDERER_SOURCE_COUNT; i++) {
+        mixer_source_t *src = &sources[i];
+        memset(src, 0, sizeof(mixer_source_t));
+        src->ring = fifo_create(i == RENDERER_SOURCE_CONTENT ? RENDERER_PCM_RING_SIZE : RENDERER_DIALOG_RING_SIZE,
+                FIFO_BACKING_RAM);
+        src->gain = MIXER_GAIN_UNITY;
+        src->ramp_gain = MIXER_GAIN_UNITY;
+        if (config->output_sample_rate != 0) {
+            src->resampler = resampler_create();
+        }
+    }
+
+    renderer_reset_stats();
+    renderer_task_exited = xSemaphoreCreateBinary();
+
+    if (xTaskCreatePinnedToCore(renderer_task, "renderer_task", sink->stack_size, config,
+            PRIO_RENDERER, &renderer_task_handle, 1) != pdPASS) {
+        ESP_LOGE(TAG, "ERROR creating renderer task! Out of memory?");
     }
 }
 
@@ -249,11 +1038,9 @@ void renderer_start()
     if(renderer_status == RUNNING)
         return;
 
+    // the renderer task starts DMA and fades in
     renderer_status = RUNNING;
-    i2s_start(renderer_instance->i2s_num);
-
-    // buffer might contain noise
-    i2s_zero_dma_buffer(renderer_instance->i2s_num);
+    xTaskNotifyGive(renderer_task_handle);
 }
 
 void renderer_stop()
@@ -261,13 +1048,26 @@ void renderer_stop()
     if(renderer_status == STOPPED)
         return;
 
+    // the renderer task fades out, then stops DMA
     renderer_status = STOPPED;
-    i2s_stop(renderer_instance->i2s_num);
+    xTaskNotifyGive(renderer_task_handle);
 }
 
 void renderer_destroy()
 {
     renderer_status = UNINITIALIZED;
-    i2s_driver_uninstall(renderer_instance->i2s_num);
-}
+    xTaskNotifyGive(renderer_task_handle);
 
+    // the driver has to outlive the task
+    xSemaphoreTake(renderer_task_exited, portMAX_DELAY);
+    vSemaphoreDelete(renderer_task_exited);
+
+    for (int i = 0; i < RENDERER_SOURCE_COUNT; i++) {
+        fifo_destroy(sources[i].ring);
+        resampler_destroy(sources[i].resampler);
+        sources[i].ring = NULL;
+        sources[i].resampler = NULL;
+    }
+
+    sink->close(renderer_instance);
+}
@@ -11,19 +11,41 @@
 #include "freertos/FreeRTOS.h"
 #include "driver/i2s.h"
 #include "common_component.h"
+#include "fifo.h"
+
+/* decoded PCM waiting for DMA: 16 KB are ~93 ms of 16 bit stereo at
+ * 44.1 kHz, half that with 32 bit frames */
+#define RENDERER_PCM_RING_SIZE (16 * 1024)
+#define RENDERER_DIALOG_RING_SIZE (8 * 1024)
 
 typedef enum {
     I2S, I2S_MERUS, DAC_BUILT_IN, PDM
 } output_mode_t;
 
 
-typedef struct
+/* how much audio the I2S DMA buffers hold, a zeroed config gets NORMAL */
+typedef enum {
+    LATENCY_NORMAL, LATENCY_LOW, LATENCY_DEEP
+} latency_profile_t;
+
+struct renderer_sink;
+
+typedef struct renderer_config
 {
     output_mode_t output_mode;
     int sample_rate;
     float sample_rate_modifier;
+    /* 0: the I2S clock follows each stream. Otherwise I2S stays at this rate
+     * and streams are resampled, sample_rate_modifier included. */
+    uint32_t output_sample_rate;
+    /* DMA depth for content, the dialog always plays with LATENCY_LOW */
+    latency_profile_t latency;
     i2s_bits_per_sample_t bit_depth;
     i2s_port_t i2s_num;
+    /* where frames go, see renderer_sink.h */
+    const struct renderer_sink *sink;
+    /* file written by the WAV sink */
+    const char *sink_path;
 } renderer_config_t;
 
 /* ESP32 is Little Endian, I2S is Big Endian.
@@ -51,15 +73,93 @@ typedef struct
 } pcm_format_t;
 
 
-/* generic renderer interface */
+/* mixer inputs, content is ducked while the dialog plays */
+typedef enum
+{
+    RENDERER_SOURCE_CONTENT, RENDERER_SOURCE_DIALOG, RENDERER_SOURCE_COUNT
+} renderer_source_t;
+
+/* generic renderer interface, queues the samples for the renderer task.
+ * Each source takes one producer at a time. */
+void render_source_samples(renderer_source_t source, char *buf, uint32_t len, pcm_format_t *format);
+
+/* same for the content source */
 void render_samples(char *buf, uint32_t len, pcm_format_t *format);
 
+/* Bit depth, channels and layout the renderer queues without converting.
+ * Decoders that can should produce it, the sample rate is theirs. */
+void renderer_get_format(pcm_format_t *format);
+
+/* Q15 gain of a source, 0x8000 is unity. Changes are ramped. */
+void renderer_set_gain(renderer_source_t source, int32_t gain);
+
+#define RENDERER_VOLUME_MAX 100
+
+/* Volume of the whole output, 0 to RENDERER_VOLUME_MAX, and mute. Changes
+ * are ramped. The MA120x0 amp applies them itself with I2S_MERUS. */
+void renderer_set_volume(uint8_t volume);
+uint8_t renderer_get_volume();
+void renderer_set_mute(bool mute);
+bool renderer_get_mute();
+
+#define RENDERER_LATENCY_BUCKETS 8
+
+/**
+ * Renderer telemetry since renderer_reset_stats(). Latency is measured per
+ * block from render_source_samples() to the I2S driver taking it, buckets
+ * end at 5, 10, 20, 50, 100, 200 and 500 ms, the last one takes the rest.
+ * Copied without locking, like the FIFO stats.
+ */
+typedef struct {
+    uint32_t since;                 /* ms since boot when collection started */
+    uint32_t dma_buffers_sent;
+    uint32_t dma_buffers_starved;   /* sent without fresh samples */
+    uint32_t underruns;             /* DMA ran dry and playback went on */
+    uint32_t last_underrun_ms;
+    uint32_t blocks[RENDERER_SOURCE_COUNT];
+    uint32_t latency_max_ms[RENDERER_SOURCE_COUNT];
+    uint32_t latency_hist[RENDERER_SOURCE_COUNT][RENDERER_LATENCY_BUCKETS];
+} renderer_stats_t;
+
+void renderer_get_stats(renderer_stats_t *stats);
+void renderer_reset_stats();
+
+/* log the telemetry to the console */
+void renderer_dump_stats();
+
+/* DMA depth for content, takes effect with the next block */
+void renderer_set_latency(latency_profile_t profile);
+
+/* time until audio queued now for source is heard: its PCM ring plus DMA */
+uint32_t renderer_get_output_latency_ms(renderer_source_t source);
+
+/* Samples queued for source from now on belong to a new stream, returns its
+ * id. Called by the producer before the first samples of a stream. */
+uint32_t renderer_start_stream(renderer_source_t source);
+
+/**
+ * Playback time of a stream that has been heard, frames still in DMA don't
+ * count. 0 before it plays, its full length once the next stream plays.
+ * Cheap, reads a few counters of the renderer task.
+ */
+uint32_t renderer_get_stream_position_ms(renderer_source_t source, uint32_t stream);
+
 void renderer_init(renderer_config_t *config);
 void renderer_start();
 void renderer_stop();
 void renderer_destroy();
 
-void renderer_zero_dma_buffer();
+/* fade out what is queued for source and drop it, e.g. when a stream is
+ * aborted. Samples queued afterwards fade in. */
+void renderer_flush(renderer_source_t source);
+
+/**
+ * A paused source fades out and keeps its queued frames, even while the
+ * renderer is stopped. Its producer blocks once the ring is full. Flushed
+ * frames are dropped all the same. Resuming fades it in where it left off.
+ */
+void renderer_pause(renderer_source_t source, bool pause);
+
 renderer_config_t *renderer_get();
 
 
@@ -0,0 +1,44 @@
+/*
+ * mixer.h
+ *
+ *  Created on: 27.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef INCLUDE_MIXER_H_
+#define INCLUDE_MIXER_H_
+
+#include <inttypes.h>
+
+/* gains are Q15, this one passes samples unchanged */
+#define MIXER_GAIN_UNITY 0x8000
+
+/* a gain change takes this many frames from 0 to unity, ~21 ms at 48 kHz */
+#define MIXER_RAMP_FRAMES 1024
+#define MIXER_RAMP_STEP (MIXER_GAIN_UNITY / MIXER_RAMP_FRAMES)
+
+/* fades of the whole output are shorter, ~6 ms at 44.1 kHz */
+#define MIXER_FADE_FRAMES 256
+#define MIXER_FADE_STEP (MIXER_GAIN_UNITY / MIXER_FADE_FRAMES)
+
+/**
+ * Add frames of interleaved stereo in to acc. The gain moves from *gain
+ * towards target by MIXER_RAMP_STEP per frame and is left where it ended.
+ */
+void mixer_accumulate(int32_t *acc, const int16_t *in, uint32_t frames,
+        int32_t *gain, int32_t target);
+
+/* clip frames of acc back to interleaved 16 bit stereo */
+void mixer_saturate(const int32_t *acc, int16_t *out, uint32_t frames);
+
+/* scale interleaved stereo in place while *gain fades towards target by
+ * MIXER_FADE_STEP per frame */
+void mixer_fade(int16_t *pcm, uint32_t frames, int32_t *gain, int32_t target);
+
+/* the same for interleaved 32 bit stereo, mixed at 24 bit resolution */
+void mixer_accumulate_32(int32_t *acc, const int32_t *in, uint32_t frames,
+        int32_t *gain, int32_t target);
+void mixer_saturate_32(const int32_t *acc, int32_t *out, uint32_t frames);
+void mixer_fade_32(int32_t *pcm, uint32_t frames, int32_t *gain, int32_t target);
+
+#endif /* INCLUDE_MIXER_H_ */
@@ -0,0 +1,45 @@
+/*
+ * pcm_convert.h
+ *
+ *  Created on: 24.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef INCLUDE_PCM_CONVERT_H_
+#define INCLUDE_PCM_CONVERT_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "audio_renderer.h"
+
+/* frames converted per block, sizes the scratch buffer of the caller */
+#define PCM_BLOCK_FRAMES 128
+
+/* largest output frame: two 32 bit slots */
+#define PCM_MAX_FRAME_BYTES 8
+
+/**
+ * Converts frames of 16 or 32 bit samples into I2S frames. left and right
+ * point to the first sample of each channel, both advance by in_stride
+ * samples per frame. Mono input passes the same pointer twice.
+ */
+typedef void (*pcm_convert_fn)(const void *left, const void *right,
+        void *out, size_t frames);
+
+typedef struct
+{
+    pcm_convert_fn convert;
+    uint8_t in_stride;
+    uint8_t in_sample_bytes;
+    uint8_t out_frame_bytes;
+} pcm_converter_t;
+
+/**
+ * Pick the kernel for the input format and the output the renderer is set up
+ * for. Returns -1 if there is none.
+ */
+int pcm_converter_init(pcm_converter_t *conv, pcm_format_t *in,
+        output_mode_t output_mode, i2s_bits_per_sample_t out_depth);
+
+#endif /* INCLUDE_PCM_CONVERT_H_ */
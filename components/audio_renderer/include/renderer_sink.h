@@ -0,0 +1,69 @@
+/*
+ * renderer_sink.h
+ *
+ * Where the renderer task puts converted frames. The I2S sink drives the
+ * hardware, the WAV and null sinks let the decode pipeline run without it,
+ * e.g. on a host for throughput and bit-exactness checks.
+ *
+ *  Created on: 29.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef INCLUDE_RENDERER_SINK_H_
+#define INCLUDE_RENDERER_SINK_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+struct renderer_config;
+
+typedef struct renderer_sink
+{
+    const char *name;
+
+    /* Plays in real time and posts an I2S_EVENT_TX_DONE per buffer sent.
+     * A sink without a clock takes what is written at once, the renderer
+     * doesn't fade around gaps or count underruns then. */
+    bool clocked;
+
+    /* stack the renderer task needs with this sink writing from it */
+    uint32_t stack_size;
+
+    /* set up for buf_count buffers of buf_len frames, stopped. A clocked
+     * sink leaves its event queue in *events. Returns -1 on failure. */
+    int (*open)(struct renderer_config *config, uint32_t sample_rate,
+            uint32_t buf_count, uint32_t buf_len, QueueHandle_t *events);
+    void (*close)(struct renderer_config *config);
+
+    void (*start)(struct renderer_config *config);
+    void (*stop)(struct renderer_config *config);
+
+    /* replace what is buffered with silence */
+    void (*zero)(struct renderer_config *config);
+
+    void (*set_sample_rate)(struct renderer_config *config, uint32_t sample_rate);
+
+    /* returns the number of bytes taken, waits up to ticks for room */
+    int (*write)(struct renderer_config *config, const char *data, size_t len, TickType_t ticks);
+
+    /* Optional. Sets volume and mute in the output hardware, attenuation in
+     * 1/4 dB below full volume. Returns -1 if this output can't, the
+     * renderer scales the samples then. */
+    int (*set_volume)(struct renderer_config *config, uint32_t attenuation, bool mute);
+} renderer_sink_t;
+
+/* the I2S peripheral, set up by output_mode, bit_depth and i2s_num. With
+ * I2S_MERUS the MA120x0 amplifier sets the volume. */
+extern const renderer_sink_t renderer_sink_i2s;
+
+/* a WAV file at sink_path, in the frames I2S would get */
+extern const renderer_sink_t renderer_sink_wav;
+
+/* discards the frames, logs how much faster than real time they came */
+extern const renderer_sink_t renderer_sink_null;
+
+#endif /* INCLUDE_RENDERER_SINK_H_ */
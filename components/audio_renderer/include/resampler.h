@@ -0,0 +1,80 @@
+/*
+ * resampler.h
+ *
+ *  Created on: 26.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef INCLUDE_RESAMPLER_H_
+#define INCLUDE_RESAMPLER_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+/* filter length per phase, each output frame costs 2 * RESAMPLER_TAPS MACs */
+#define RESAMPLER_TAPS 24
+
+/* rational ratios up to this many phases get an exact table, this covers
+ * 44.1 <-> 48 kHz (160/147) and everything simpler */
+#define RESAMPLER_MAX_PHASES 160
+
+/* anything else, including a sample_rate_modifier, interpolates between
+ * the rows of a table with this many phases */
+#define RESAMPLER_FRAC_PHASES_LOG2 7
+#define RESAMPLER_FRAC_PHASES (1 << RESAMPLER_FRAC_PHASES_LOG2)
+
+/* at most this many input frames per output frame */
+#define RESAMPLER_MAX_DECIMATION 4
+
+/* input frames buffered per pass */
+#define RESAMPLER_HIST_FRAMES (RESAMPLER_TAPS + 128)
+
+typedef struct
+{
+    uint32_t in_rate;
+    uint32_t out_rate;
+    float modifier;
+
+    /* exact: phases rows, step_frac counts in 1/phases of an input frame.
+     * fractional: phases + 1 rows, step_frac is Q32 */
+    bool fractional;
+    uint32_t phases;
+    uint32_t step_int;
+    uint32_t step_frac;
+
+    /* position of the next output frame: first tap at hist[pos], frac
+     * between input frames */
+    uint32_t pos;
+    uint32_t frac;
+
+    /* interleaved stereo input */
+    uint32_t hist_len;
+    int16_t hist[RESAMPLER_HIST_FRAMES * 2];
+
+    int16_t coeffs[(RESAMPLER_MAX_PHASES + 1) * RESAMPLER_TAPS];
+} resampler_t;
+
+resampler_t *resampler_create();
+void resampler_destroy(resampler_t *rs);
+
+/**
+ * Prepare to convert from in_rate * modifier to out_rate. The filter table is
+ * only rebuilt, and the history only dropped, if the ratio changed.
+ * Returns -1 if the ratio is out of range.
+ */
+int resampler_set_rates(resampler_t *rs, uint32_t in_rate, uint32_t out_rate, float modifier);
+
+/* forget buffered input, e.g. when a new stream starts */
+void resampler_reset(resampler_t *rs);
+
+/**
+ * Convert 16 bit frames. left and right advance by in_stride samples per
+ * frame, mono input passes the same pointer twice. Takes at most *in_frames
+ * and leaves the number taken there, writes at most out_frames interleaved
+ * stereo frames to out and returns how many.
+ */
+size_t resampler_process(resampler_t *rs, const int16_t *left, const int16_t *right,
+        uint8_t in_stride, size_t *in_frames, int16_t *out, size_t out_frames);
+
+#endif /* INCLUDE_RESAMPLER_H_ */
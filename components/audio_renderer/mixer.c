@@ -0,0 +1,154 @@
+/*
+ * mixer.c
+ *
+ * Sums interleaved 16 bit stereo blocks. Each input is scaled by its Q15
+ * gain into a 32 bit accumulator, so any number of full scale inputs fit,
+ * and the sum is clipped once per block.
+ *
+ * 32 bit samples go into the same accumulator with MIXER_HEADROOM_BITS
+ * taken off, a mix keeps 24 bits of each input.
+ *
+ *  Created on: 27.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "mixer.h"
+
+/* room for 256 full scale inputs above 24 bit samples */
+#define MIXER_HEADROOM_BITS 8
+
+static inline int32_t ramp(int32_t g, int32_t target, int32_t step)
+{
+    if (g < target)
+        return target - g > step ? g + step : target;
+
+    return g - target > step ? g - step : target;
+}
+
+void mixer_accumulate(int32_t *acc, const int16_t *in, uint32_t frames,
+        int32_t *gain, int32_t target)
+{
+    int32_t g = *gain;
+    uint32_t i = 0;
+
+    // per frame gain while ramping
+    for (; i < frames && g != target; i++) {
+        g = ramp(g, target, MIXER_RAMP_STEP);
+        acc[2 * i] += (in[2 * i] * g) >> 15;
+        acc[2 * i + 1] += (in[2 * i + 1] * g) >> 15;
+    }
+    *gain = g;
+
+    if (g == MIXER_GAIN_UNITY) {
+        for (; i < frames; i++) {
+            acc[2 * i] += in[2 * i];
+            acc[2 * i + 1] += in[2 * i + 1];
+        }
+    } else if (g != 0) {
+        for (; i < frames; i++) {
+            acc[2 * i] += (in[2 * i] * g) >> 15;
+            acc[2 * i + 1] += (in[2 * i + 1] * g) >> 15;
+        }
+    }
+}
+
+void mixer_saturate(const int32_t *acc, int16_t *out, uint32_t frames)
+{
+    for (uint32_t i = 0; i < 2 * frames; i++) {
+        int32_t s = acc[i];
+        if (s > INT16_MAX) s = INT16_MAX;
+        if (s < INT16_MIN) s = INT16_MIN;
+        out[i] = s;
+    }
+}
+
+void mixer_fade(int16_t *pcm, uint32_t frames, int32_t *gain, int32_t target)
+{
+    int32_t g = *gain;
+    uint32_t i = 0;
+
+    for (; i < frames && g != target; i++) {
+        g = ramp(g, target, MIXER_FADE_STEP);
+        pcm[2 * i] = (pcm[2 * i] * g) >> 15;
+        pcm[2 * i + 1] = (pcm[2 * i + 1] * g) >> 15;
+    }
+    *gain = g;
+
+    if (g == 0) {
+        memset(pcm + 2 * i, 0, (frames - i) * 2 * sizeof(int16_t));
+    } else if (g != MIXER_GAIN_UNITY) {
+        for (; i < frames; i++) {
+            pcm[2 * i] = (pcm[2 * i] * g) >> 15;
+            pcm[2 * i + 1] = (pcm[2 * i + 1] * g) >> 15;
+        }
+    }
+}
+
+static inline int32_t scale_32(int32_t s, int32_t g)
+{
+    return ((int64_t) s * g) >> 15;
+}
+
+void mixer_accumulate_32(int32_t *acc, const int32_t *in, uint32_t frames,
+        int32_t *gain, int32_t target)
+{
+    int32_t g = *gain;
+    uint32_t i = 0;
+
+    for (; i < frames && g != target; i++) {
+        g = ramp(g, target, MIXER_RAMP_STEP);
+        acc[2 * i] += scale_32(in[2 * i], g) >> MIXER_HEADROOM_BITS;
+        acc[2 * i + 1] += scale_32(in[2 * i + 1], g) >> MIXER_HEADROOM_BITS;
+    }
+    *gain = g;
+
+    if (g == MIXER_GAIN_UNITY) {
+        for (; i < frames; i++) {
+            acc[2 * i] += in[2 * i] >> MIXER_HEADROOM_BITS;
+            acc[2 * i + 1] += in[2 * i + 1] >> MIXER_HEADROOM_BITS;
+        }
+    } else if (g != 0) {
+        for (; i < frames; i++) {
+            acc[2 * i] += scale_32(in[2 * i], g) >> MIXER_HEADROOM_BITS;
+            acc[2 * i + 1] += scale_32(in[2 * i + 1], g) >> MIXER_HEADROOM_BITS;
+        }
+    }
+}
+
+void mixer_saturate_32(const int32_t *acc, int32_t *out, uint32_t frames)
+{
+    const int32_t hi = INT32_MAX >> MIXER_HEADROOM_BITS;
+    const int32_t lo = INT32_MIN >> MIXER_HEADROOM_BITS;
+
+    for (uint32_t i = 0; i < 2 * frames; i++) {
+        int32_t s = acc[i];
+        if (s > hi) s = hi;
+        if (s < lo) s = lo;
+        out[i] = (int32_t) ((uint32_t) s << MIXER_HEADROOM_BITS);
+    }
+}
+
+void mixer_fade_32(int32_t *pcm, uint32_t frames, int32_t *gain, int32_t target)
+{
+    int32_t g = *gain;
+    uint32_t i = 0;
+
+    for (; i < frames && g != target; i++) {
+        g = ramp(g, target, MIXER_FADE_STEP);
+        pcm[2 * i] = scale_32(pcm[2 * i], g);
+        pcm[2 * i + 1] = scale_32(pcm[2 * i + 1], g);
+    }
+    *gain = g;
+
+    if (g == 0) {
+        memset(pcm + 2 * i, 0, (frames - i) * 2 * sizeof(int32_t));
+    } else if (g != MIXER_GAIN_UNITY) {
+        for (; i < frames; i++) {
+            pcm[2 * i] = scale_32(pcm[2 * i], g);
+            pcm[2 * i + 1] = scale_32(pcm[2 * i + 1], g);
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * pcm_convert.c
+ *
+ * Block conversion from decoder PCM to the frame format the I2S peripheral
+ * expects. Each kernel handles one input depth and stride and one output
+ * format, so the loop body has no branches and constant offsets, and is
+ * unrolled by four for the compiler to schedule loads and stores back to
+ * back.
+ *
+ *  Created on: 24.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "pcm_convert.h"
+
+/*
+ * Kernels load each sample into the upper half of an int32, so 16 and 32
+ * bit input share the store functions. For 16 bit input the shifts cancel
+ * out at compile time, 32 bit input is truncated to the 16 bit outputs.
+ */
+
+/* 16 bit slots, left channel in the low half, sent first */
+static inline uint32_t frame_i2s_16(int32_t l, int32_t r)
+{
+    return (uint16_t) (l >> 16) | (uint32_t) (uint16_t) (r >> 16) << 16;
+}
+
+/* The built-in DAC wants unsigned samples, so the range is shifted from
+ * -32768..32767 to 0..65535. Left goes into the high half here. */
+static inline uint32_t frame_dac(int32_t l, int32_t r)
+{
+    return (uint32_t) (uint16_t) ((l >> 16) ^ 0x8000) << 16 | (uint16_t) ((r >> 16) ^ 0x8000);
+}
+
+#define STORE_16(o, i, l, r)    ((uint32_t *) (o))[(i)] = frame_i2s_16((l), (r))
+#define STORE_DAC(o, i, l, r)   ((uint32_t *) (o))[(i)] = frame_dac((l), (r))
+
+/* 32 bit slots, left first */
+#define STORE_32(o, i, l, r)                                                   \
+    do {                                                                       \
+        ((int32_t *) (o))[2 * (i)] = (l);                                      \
+        ((int32_t *) (o))[2 * (i) + 1] = (r);                                  \
+    } while (0)
+
+#define LOAD_16(p, k)   ((int32_t) ((uint32_t) ((const uint16_t *) (p))[(k)] << 16))
+#define LOAD_32(p, k)   (((const int32_t *) (p))[(k)])
+
+#define DEFINE_KERNEL(name, type, load, stride, store)                         \
+static void name(const void *in_l, const void *in_r, void *out, size_t frames) \
+{                                                                              \
+    const type *l = in_l;                                                      \
+    const type *r = in_r;                                                      \
+    size_t i = 0;                                                              \
+    for (; i + 4 <= frames; i += 4) {                                          \
+        store(out, i, load(l, 0), load(r, 0));                                 \
+        store(out, i + 1, load(l, (stride)), load(r, (stride)));               \
+        store(out, i + 2, load(l, 2 * (stride)), load(r, 2 * (stride)));       \
+        store(out, i + 3, load(l, 3 * (stride)), load(r, 3 * (stride)));       \
+        l += 4 * (stride);                                                     \
+        r += 4 * (stride);                                                     \
+    }                                                                          \
+    for (; i < frames; i++) {                                                  \
+        store(out, i, load(l, 0), load(r, 0));                                 \
+        l += (stride);                                                         \
+        r += (stride);                                                         \
+    }                                                                          \
+}
+
+/* interleaved stereo: L R L R ... */
+DEFINE_KERNEL(interleaved_16_to_16, int16_t, LOAD_16, 2, STORE_16)
+DEFINE_KERNEL(interleaved_16_to_32, int16_t, LOAD_16, 2, STORE_32)
+DEFINE_KERNEL(interleaved_16_to_dac, int16_t, LOAD_16, 2, STORE_DAC)
+DEFINE_KERNEL(interleaved_32_to_16, int32_t, LOAD_32, 2, STORE_16)
+DEFINE_KERNEL(interleaved_32_to_32, int32_t, LOAD_32, 2, STORE_32)
+DEFINE_KERNEL(interleaved_32_to_dac, int32_t, LOAD_32, 2, STORE_DAC)
+
+/* planar stereo (L L ... R R ...) and mono */
+DEFINE_KERNEL(planar_16_to_16, int16_t, LOAD_16, 1, STORE_16)
+DEFINE_KERNEL(planar_16_to_32, int16_t, LOAD_16, 1, STORE_32)
+DEFINE_KERNEL(planar_16_to_dac, int16_t, LOAD_16, 1, STORE_DAC)
+DEFINE_KERNEL(planar_32_to_16, int32_t, LOAD_32, 1, STORE_16)
+DEFINE_KERNEL(planar_32_to_32, int32_t, LOAD_32, 1, STORE_32)
+DEFINE_KERNEL(planar_32_to_dac, int32_t, LOAD_32, 1, STORE_DAC)
+
+/* [input depth][interleaved][output] */
+enum { OUT_16, OUT_32, OUT_DAC };
+
+static const pcm_convert_fn kernels[2][2][3] = {
+    {
+        { planar_16_to_16, planar_16_to_32, planar_16_to_dac },
+        { interleaved_16_to_16, interleaved_16_to_32, interleaved_16_to_dac }
+    },
+    {
+        { planar_32_to_16, planar_32_to_32, planar_32_to_dac },
+        { interleaved_32_to_16, interleaved_32_to_32, interleaved_32_to_dac }
+    }
+};
+
+int pcm_converter_init(pcm_converter_t *conv, pcm_format_t *in,
+        output_mode_t output_mode, i2s_bits_per_sample_t out_depth)
+{
+    int wide;
+    int out;
+
+    switch (in->bit_depth) {
+        case I2S_BITS_PER_SAMPLE_16BIT:
+            wide = 0;
+            break;
+        case I2S_BITS_PER_SAMPLE_32BIT:
+            wide = 1;
+            break;
+        default:
+            return -1;
+    }
+
+    if (output_mode == DAC_BUILT_IN) {
+        out = OUT_DAC;
+        conv->out_frame_bytes = 4;
+    } else if (out_depth == I2S_BITS_PER_SAMPLE_16BIT) {
+        out = OUT_16;
+        conv->out_frame_bytes = 4;
+    } else if (out_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+        out = OUT_32;
+        conv->out_frame_bytes = 8;
+    } else {
+        return -1;
+    }
+
+    bool interleaved = in->num_channels == 2 && in->buffer_format == PCM_INTERLEAVED;
+    conv->in_stride = interleaved ? 2 : 1;
+    conv->in_sample_bytes = in->bit_depth / 8;
+    conv->convert = kernels[wide][interleaved][out];
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * resampler.c
+ *
+ * Fixed-point polyphase sample-rate converter. The prototype is a
+ * Kaiser-windowed sinc, sampled once per phase into a Q15 table when the
+ * ratio changes. Converting a frame is then one dot product per channel.
+ *
+ * Rational ratios with few enough phases step through the table exactly.
+ * Everything else keeps a Q32 position between input frames and
+ * interpolates the coefficients of the two neighbouring rows.
+ *
+ *  Created on: 26.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "esp_log.h"
+
+#include "resampler.h"
+
+#define TAG "resampler"
+
+/* cutoff relative to the lower Nyquist frequency, the rest is transition */
+#define RESAMPLER_PASSBAND 0.9f
+
+/* ~70 dB stopband */
+#define KAISER_BETA 7.0f
+
+/* the first output frame is centred on the first input frame */
+#define CENTER_TAP (RESAMPLER_TAPS / 2 - 1)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* modified Bessel function of the first kind, order 0 */
+static float bessel_i0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    float q = x * x / 4.0f;
+
+    for (int k = 1; k < 32; k++) {
+        term *= q / (k * k);
+        sum += term;
+        if (term < sum * 1e-7f)
+            break;
+    }
+    return sum;
+}
+
+/**
+ * One row of the table: the filter response for an output frame that lies
+ * f input frames after the centre tap, fc in cycles per input frame.
+ * Normalised to unity gain at DC, the rounding error goes to the largest tap.
+ */
+static void build_row(int16_t *row, float f, float fc)
+{
+    float h[RESAMPLER_TAPS];
+    float sum = 0.0f;
+    float i0_beta = bessel_i0(KAISER_BETA);
+
+    for (int k = 0; k < RESAMPLER_TAPS; k++) {
+        float t = k - CENTER_TAP - f;
+        float x = t / (RESAMPLER_TAPS / 2);
+        float w = 0.0f;
+        if (x > -1.0f && x < 1.0f)
+            w = bessel_i0(KAISER_BETA * sqrtf(1.0f - x * x)) / i0_beta;
+
+        float arg = (float) M_PI * 2.0f * fc * t;
+        float sinc = fabsf(arg) < 1e-6f ? 1.0f : sinf(arg) / arg;
+
+        h[k] = sinc * w;
+        sum += h[k];
+    }
+
+    int32_t total = 0;
+    int largest = 0;
+    for (int k = 0; k < RESAMPLER_TAPS; k++) {
+        int32_t c = (int32_t) floorf(h[k] / sum * 32768.0f + 0.5f);
+        if (c > INT16_MAX) c = INT16_MAX;
+        if (c < INT16_MIN) c = INT16_MIN;
+        row[k] = c;
+        total += c;
+        if (abs(c) > abs(row[largest]))
+            largest = k;
+    }
+
+    int32_t c = row[largest] + 32768 - total;
+    row[largest] = c > INT16_MAX ? INT16_MAX : c;
+}
+
+resampler_t *resampler_create()
+{
+    resampler_t *rs = calloc(1, sizeof(resampler_t));
+    if (rs == NULL)
+        return NULL;
+
+    resampler_reset(rs);
+    return rs;
+}
+
+void resampler_destroy(resampler_t *rs)
+{
+    free(rs);
+}
+
+void resampler_reset(resampler_t *rs)
+{
+    memset(rs->hist, 0, sizeof(rs->hist));
+    rs->hist_len = CENTER_TAP;
+    rs->pos = 0;
+    rs->frac = 0;
+}
+
+int resampler_set_rates(resampler_t *rs, uint32_t in_rate, uint32_t out_rate, float modifier)
+{
+    if (in_rate == rs->in_rate && out_rate == rs->out_rate && modifier == rs->modifier)
+        return 0;
+
+    float in_eff = in_rate * modifier;
+    if (in_rate == 0 || out_rate == 0 || modifier <= 0.0f
+            || in_eff > (float) out_rate * RESAMPLER_MAX_DECIMATION) {
+        ESP_LOGE(TAG, "can't convert %d Hz * %f to %d Hz", in_rate, modifier, out_rate);
+        return -1;
+    }
+
+    uint32_t g = gcd(in_rate, out_rate);
+    uint32_t up = out_rate / g;
+    uint32_t down = in_rate / g;
+
+    if (modifier == 1.0f && up <= RESAMPLER_MAX_PHASES) {
+        rs->fractional = false;
+        rs->phases = up;
+        rs->step_int = down / up;
+        rs->step_frac = down % up;
+    } else {
+        rs->fractional = true;
+        rs->phases = RESAMPLER_FRAC_PHASES;
+        uint64_t step = (uint64_t) ((double) in_eff / out_rate * 4294967296.0);
+        rs->step_int = step >> 32;
+        rs->step_frac = (uint32_t) step;
+    }
+
+    // downsampling moves the cutoff below the output Nyquist frequency
+    float fc = 0.5f * RESAMPLER_PASSBAND;
+    if (in_eff > out_rate)
+        fc *= out_rate / in_eff;
+
+    uint32_t rows = rs->phases + (rs->fractional ? 1 : 0);
+    for (uint32_t p = 0; p < rows; p++) {
+        build_row(rs->coeffs + p * RESAMPLER_TAPS, (float) p / rs->phases, fc);
+    }
+
+    ESP_LOGI(TAG, "%d Hz * %f -> %d Hz, %s, %d phases", in_rate, modifier, out_rate,
+            rs->fractional ? "fractional" : "exact", rs->phases);
+
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->modifier = modifier;
+    resampler_reset(rs);
+
+    return 0;
+}
+
+static inline int16_t saturate_q15(int32_t acc)
+{
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > INT16_MAX) return INT16_MAX;
+    if (acc < INT16_MIN) return INT16_MIN;
+    return acc;
+}
+
+static inline void filter_frame(const int16_t *c, const int16_t *x, int16_t *out)
+{
+    int32_t acc_l = 0;
+    int32_t acc_r = 0;
+
+    for (int k = 0; k < RESAMPLER_TAPS; k++) {
+        acc_l += c[k] * x[2 * k];
+        acc_r += c[k] * x[2 * k + 1];
+    }
+
+    out[0] = saturate_q15(acc_l);
+    out[1] = saturate_q15(acc_r);
+}
+
+size_t resampler_process(resampler_t *rs, const int16_t *left, const int16_t *right,
+        uint8_t in_stride, size_t *in_frames, int16_t *out, size_t out_frames)
+{
+    size_t in_left = *in_frames;
+    size_t produced = 0;
+    int16_t row[RESAMPLER_TAPS];
+
+    while (produced < out_frames) {
+
+        // not enough input under the filter, refill the history
+        if (rs->pos + RESAMPLER_TAPS > rs->hist_len) {
+            if (in_left == 0)
+                break;
+
+            uint32_t keep = rs->hist_len - rs->pos;
+            memmove(rs->hist, rs->hist + 2 * rs->pos, keep * 2 * sizeof(int16_t));
+            rs->hist_len = keep;
+            rs->pos = 0;
+
+            size_t n = min(in_left, RESAMPLER_HIST_FRAMES - keep);
+            int16_t *dst = rs->hist + 2 * keep;
+            for (size_t i = 0; i < n; i++) {
+                dst[2 * i] = *left;
+                dst[2 * i + 1] = *right;
+                left += in_stride;
+                right += in_stride;
+            }
+            rs->hist_len += n;
+            in_left -= n;
+            continue;
+        }
+
+        const int16_t *x = rs->hist + 2 * rs->pos;
+
+        if (rs->fractional) {
+            uint32_t p = rs->frac >> (32 - RESAMPLER_FRAC_PHASES_LOG2);
+            int32_t w = (rs->frac >> (17 - RESAMPLER_FRAC_PHASES_LOG2)) & 0x7fff;
+            const int16_t *c0 = rs->coeffs + p * RESAMPLER_TAPS;
+            const int16_t *c1 = c0 + RESAMPLER_TAPS;
+            for (int k = 0; k < RESAMPLER_TAPS; k++) {
+                row[k] = c0[k] + (((c1[k] - c0[k]) * w) >> 15);
+            }
+            filter_frame(row, x, out + 2 * produced);
+
+            uint32_t frac = rs->frac + rs->step_frac;
+            rs->pos += rs->step_int + (frac < rs->frac);
+            rs->frac = frac;
+        } else {
+            filter_frame(rs->coeffs + rs->frac * RESAMPLER_TAPS, x, out + 2 * produced);
+
+            rs->pos += rs->step_int;
+            rs->frac += rs->step_frac;
+            if (rs->frac >= rs->phases) {
+                rs->frac -= rs->phases;
+                rs->pos++;
+            }
+        }
+
+        produced++;
+    }
+
+    *in_frames -= in_left;
+    return produced;
+}
@@ -0,0 +1,140 @@
+/*
+ * sink_i2s.c
+ *
+ *  Created on: 29.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+#include "driver/gpio.h"
+#include "driver/i2s.h"
+
+#include "MerusAudio.h"
+
+#include "audio_renderer.h"
+#include "renderer_sink.h"
+
+#define TAG "sink_i2s"
+
+/* init_ma120() used to fix the amp at 0x50, 56 dB below its 0 dB. The full
+ * volume stays there, the range goes below it. */
+#define MA120_FULL_SCALE_DB 56
+
+static bool ma120_ready;
+
+static int i2s_sink_open(renderer_config_t *config, uint32_t sample_rate,
+        uint32_t buf_count, uint32_t buf_len, QueueHandle_t *events)
+{
+    i2s_mode_t mode = I2S_MODE_MASTER | I2S_MODE_TX;
+    i2s_comm_format_t comm_fmt = I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB;
+
+    if(config->output_mode == DAC_BUILT_IN)
+    {
+        mode = mode | I2S_MODE_DAC_BUILT_IN;
+        comm_fmt = I2S_COMM_FORMAT_I2S_MSB;
+    }
+
+    if(config->output_mode == PDM)
+    {
+        mode = mode | I2S_MODE_PDM;
+    }
+
+    i2s_config_t i2s_config = {
+            .mode = mode,          // Only TX
+            .sample_rate = sample_rate,
+            .bits_per_sample = config->bit_depth,
+            .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,   // 2-channels
+            .communication_format = comm_fmt,
+            .dma_buf_count = buf_count,
+            .dma_buf_len = buf_len,
+            .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1        // Interrupt level 1
+    };
+
+    i2s_pin_config_t pin_config = {
+            .bck_io_num = GPIO_NUM_26,
+            .ws_io_num = GPIO_NUM_25,
+            .data_out_num = GPIO_NUM_22,
+            .data_in_num = I2S_PIN_NO_CHANGE
+    };
+
+    // room for the events of a whole DMA round between two blocks
+    if (i2s_driver_install(config->i2s_num, &i2s_config, 2 * buf_count, events) != ESP_OK) {
+        ESP_LOGE(TAG, "driver install failed");
+        return -1;
+    }
+
+    if((mode & I2S_MODE_DAC_BUILT_IN) || (mode & I2S_MODE_PDM))
+    {
+        i2s_set_pin(config->i2s_num, NULL);
+        i2s_set_dac_mode(I2S_DAC_CHANNEL_BOTH_EN);
+    }
+    else {
+        i2s_set_pin(config->i2s_num, &pin_config);
+    }
+
+    i2s_stop(config->i2s_num);
+    return 0;
+}
+
+static void i2s_sink_close(renderer_config_t *config)
+{
+    i2s_driver_uninstall(config->i2s_num);
+}
+
+static void i2s_sink_start(renderer_config_t *config)
+{
+    i2s_start(config->i2s_num);
+}
+
+static void i2s_sink_stop(renderer_config_t *config)
+{
+    i2s_stop(config->i2s_num);
+}
+
+static void i2s_sink_zero(renderer_config_t *config)
+{
+    i2s_zero_dma_buffer(config->i2s_num);
+}
+
+static void i2s_sink_set_sample_rate(renderer_config_t *config, uint32_t sample_rate)
+{
+    i2s_set_sample_rates(config->i2s_num, sample_rate);
+}
+
+static int i2s_sink_write(renderer_config_t *config, const char *data, size_t len, TickType_t ticks)
+{
+    return i2s_write_bytes(config->i2s_num, data, len, ticks);
+}
+
+/* only the MA120x0 has a volume of its own */
+static int i2s_sink_set_volume(renderer_config_t *config, uint32_t attenuation, bool mute)
+{
+    if (config->output_mode != I2S_MERUS)
+        return -1;
+
+    if (!ma120_ready) {
+        init_ma120(0x50); // setup ma120x0p and initial volume
+        ma120_ready = true;
+    }
+
+    ma120_set_attenuation(MA120_FULL_SCALE_DB * 4 + attenuation);
+    ma120_set_mute(mute);
+    return 0;
+}
+
+const renderer_sink_t renderer_sink_i2s = {
+    .name = "i2s",
+    .clocked = true,
+    .stack_size = 3072,
+    .open = i2s_sink_open,
+    .close = i2s_sink_close,
+    .start = i2s_sink_start,
+    .stop = i2s_sink_stop,
+    .zero = i2s_sink_zero,
+    .set_sample_rate = i2s_sink_set_sample_rate,
+    .write = i2s_sink_write,
+    .set_volume = i2s_sink_set_volume
+};
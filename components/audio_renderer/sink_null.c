@@ -0,0 +1,114 @@
+/*
+ * sink_null.c
+ *
+ * Throws the frames away as fast as they come. The decoders and the
+ * renderer then run flat out, and the log says how much faster than real
+ * time that was.
+ *
+ *  Created on: 29.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "audio_renderer.h"
+#include "renderer_sink.h"
+
+#define TAG "sink_null"
+
+static uint32_t null_frame_bytes;
+static uint32_t null_sample_rate;
+
+/* frames are counted at the rate they were meant for */
+static uint32_t null_frames;
+static uint32_t null_audio_ms;
+static uint32_t null_started_ms;
+static uint32_t null_busy_ms;
+static bool null_running;
+
+/* move the frames so far into the audio time, before the rate changes */
+static void null_account()
+{
+    if (null_sample_rate > 0) {
+        null_audio_ms += (uint64_t) null_frames * 1000 / null_sample_rate;
+    }
+    null_frames = 0;
+}
+
+static void null_report()
+{
+    null_account();
+
+    uint32_t busy_ms = null_busy_ms;
+    if (null_running) {
+        busy_ms += esp_log_timestamp() - null_started_ms;
+    }
+
+    ESP_LOGI(TAG, "%u ms of audio in %u ms, %u.%02u x real time", null_audio_ms, busy_ms,
+            busy_ms ? null_audio_ms / busy_ms : 0,
+            busy_ms ? (null_audio_ms % busy_ms) * 100 / busy_ms : 0);
+}
+
+static int null_open(renderer_config_t *config, uint32_t sample_rate,
+        uint32_t buf_count, uint32_t buf_len, QueueHandle_t *events)
+{
+    null_frame_bytes = 2 * (config->bit_depth / 8);
+    null_sample_rate = sample_rate;
+    null_frames = 0;
+    null_audio_ms = 0;
+    null_busy_ms = 0;
+    null_running = false;
+    return 0;
+}
+
+static void null_close(renderer_config_t *config)
+{
+    null_report();
+}
+
+static void null_start(renderer_config_t *config)
+{
+    null_started_ms = esp_log_timestamp();
+    null_running = true;
+}
+
+static void null_stop(renderer_config_t *config)
+{
+    if (!null_running)
+        return;
+
+    null_busy_ms += esp_log_timestamp() - null_started_ms;
+    null_running = false;
+    null_report();
+}
+
+static void null_zero(renderer_config_t *config)
+{
+}
+
+static void null_set_sample_rate(renderer_config_t *config, uint32_t sample_rate)
+{
+    null_account();
+    null_sample_rate = sample_rate;
+}
+
+static int null_write(renderer_config_t *config, const char *data, size_t len, TickType_t ticks)
+{
+    null_frames += len / null_frame_bytes;
+    return len;
+}
+
+const renderer_sink_t renderer_sink_null = {
+    .name = "null",
+    .clocked = false,
+    .stack_size = 3072,
+    .open = null_open,
+    .close = null_close,
+    .start = null_start,
+    .stop = null_stop,
+    .zero = null_zero,
+    .set_sample_rate = null_set_sample_rate,
+    .write = null_write
+};
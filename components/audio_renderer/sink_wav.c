@@ -0,0 +1,143 @@
+/*
+ * sink_wav.c
+ *
+ * Writes the frames I2S would get to a WAV file, 16 or 32 bit stereo as
+ * set by bit_depth. The header is rewritten with the final length on close.
+ * A WAV file has one sample rate, the first one data is written at.
+ *
+ *  Created on: 29.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "audio_renderer.h"
+#include "renderer_sink.h"
+
+#define TAG "sink_wav"
+
+#define WAV_HEADER_SIZE 44
+
+static FILE *wav_file;
+static uint32_t wav_sample_rate;
+static uint32_t wav_data_bytes;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* RIFF header of a PCM file, stereo */
+static void write_header(renderer_config_t *config)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+    uint16_t block_align = 2 * (config->bit_depth / 8);
+
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, 36 + wav_data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, 1);                    // PCM
+    put_le16(h + 22, 2);
+    put_le32(h + 24, wav_sample_rate);
+    put_le32(h + 28, wav_sample_rate * block_align);
+    put_le16(h + 32, block_align);
+    put_le16(h + 34, config->bit_depth);
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, wav_data_bytes);
+
+    fseek(wav_file, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), wav_file);
+    fseek(wav_file, 0, SEEK_END);
+}
+
+static int wav_open(renderer_config_t *config, uint32_t sample_rate,
+        uint32_t buf_count, uint32_t buf_len, QueueHandle_t *events)
+{
+    // the built-in DAC gets unsigned samples in swapped halves
+    if (config->output_mode == DAC_BUILT_IN) {
+        ESP_LOGE(TAG, "can't write DAC frames to a WAV file");
+        return -1;
+    }
+
+    wav_file = fopen(config->sink_path, "wb");
+    if (wav_file == NULL) {
+        ESP_LOGE(TAG, "can't create %s", config->sink_path);
+        return -1;
+    }
+
+    wav_sample_rate = sample_rate;
+    wav_data_bytes = 0;
+    write_header(config);
+
+    ESP_LOGI(TAG, "writing %s, %d bit", config->sink_path, config->bit_depth);
+    return 0;
+}
+
+static void wav_close(renderer_config_t *config)
+{
+    if (wav_file == NULL)
+        return;
+
+    write_header(config);
+    fclose(wav_file);
+    wav_file = NULL;
+
+    ESP_LOGI(TAG, "%s: %u bytes at %u Hz", config->sink_path, wav_data_bytes, wav_sample_rate);
+}
+
+static void wav_nop(renderer_config_t *config)
+{
+}
+
+static void wav_set_sample_rate(renderer_config_t *config, uint32_t sample_rate)
+{
+    if (wav_data_bytes == 0) {
+        wav_sample_rate = sample_rate;
+    } else if (sample_rate != wav_sample_rate) {
+        ESP_LOGW(TAG, "%u Hz stream goes into a %u Hz file", sample_rate, wav_sample_rate);
+    }
+}
+
+static int wav_write(renderer_config_t *config, const char *data, size_t len, TickType_t ticks)
+{
+    if (wav_file == NULL)
+        return len;
+
+    size_t written = fwrite(data, 1, len, wav_file);
+    wav_data_bytes += written;
+
+    // a full disk doesn't stall the renderer
+    if (written < len) {
+        ESP_LOGE(TAG, "write failed, dropping %u bytes", len - written);
+    }
+
+    return len;
+}
+
+const renderer_sink_t renderer_sink_wav = {
+    .name = "wav",
+    .clocked = false,
+    // stdio on FAT goes deep
+    .stack_size = 8192,
+    .open = wav_open,
+    .close = wav_close,
+    .start = wav_nop,
+    .stop = wav_nop,
+    .zero = wav_nop,
+    .set_sample_rate = wav_set_sample_rate,
+    .write = wav_write
+};
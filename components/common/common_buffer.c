@@ -15,14 +15,56 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
-#include "spiram_fifo.h"
+#include "fifo.h"
 #include "byteswap.h"
 
 #define TAG "common"
 
+#define is_ring(buf) ((buf)->guard > 0)
+
+
+/* advance the write position after bytes have been stored at write_pos */
+static void buf_commit_write(buffer_t *buf, size_t bytes)
+{
+    if(is_ring(buf)) {
+        // keep the guard region in sync with the head of the ring
+        size_t offset = buf->write_pos - buf->base;
+        if(offset < buf->guard) {
+            memcpy(buf->base + buf->len + offset, buf->write_pos,
+                    min(bytes, buf->guard - offset));
+        }
+    }
+
+    buf->write_pos += bytes;
+    if(is_ring(buf) && buf->write_pos >= buf->base + buf->len)
+        buf->write_pos -= buf->len;
+}
+
+/* advance the read position */
+static void buf_consume(buffer_t *buf, size_t bytes)
+{
+    buf->read_pos += bytes;
+    if(is_ring(buf) && buf->read_pos >= buf->base + buf->len)
+        buf->read_pos -= buf->len;
+
+    buf->bytes_consumed += bytes;
+}
+
+/* copy out unread bytes, split in two if the ring wraps */
+static void buf_copy_out(buffer_t *buf, void *to, size_t len)
+{
+    size_t first = min(len, (size_t) (buf->base + buf->len - buf->read_pos));
+    memcpy(to, buf->read_pos, first);
+    memcpy((uint8_t *) to + first, buf->base, len - first);
+}
+
 
 size_t buf_move_remaining_bytes_to_front(buffer_t *buf)
 {
+    // nothing is stale in a ring
+    if(is_ring(buf))
+        return buf_free_capacity(buf);
+
     size_t unread_data = buf_data_unread(buf);
 
     // move remaining data to front
@@ -52,20 +94,68 @@ buffer_t *buf_create(size_t len)
     return buf;
 }
 
+/* creates a ring buffer with len + guard bytes of storage */
+buffer_t *buf_create_ring(size_t len, size_t guard)
+{
+    if(guard == 0 || guard > len) {
+        ESP_LOGE(TAG, "invalid guard size %d for ring of size %d", guard, len);
+        return NULL;
+    }
+
+    buffer_t *buf = buf_create(len + guard);
+    if(buf == NULL)
+        return NULL;
+
+    buf->len = len;
+    buf->guard = guard;
+
+    return buf;
+}
+
 /* wraps an existing buffer */
 buffer_t *buf_wrap(void *existing, size_t len)
 {
-    buffer_t* buf = calloc(1, sizeof(buffer_t));
+    buffer_t* buf = malloc(sizeof(buffer_t));
+    if(buf == NULL)
+        return NULL;
+
+    return buf_init(buf, existing, len);
+}
+
+/* wraps an existing buffer without allocating */
+buffer_t *buf_init(buffer_t *buf, void *existing, size_t len)
+{
+    memset(buf, 0, sizeof(buffer_t));
 
     buf->len = len;
     buf->base = existing;
     buf->read_pos = buf->base;
     buf->write_pos = buf->base;
-    buf->bytes_consumed = 0;
 
     return buf;
 }
 
+void buf_reset(buffer_t *buf)
+{
+    buf->read_pos = buf->base;
+    buf->write_pos = buf->base;
+    buf->bytes_consumed = 0;
+}
+
+int buf_reserve(buffer_t *buf, size_t len)
+{
+    if(buf == NULL)
+        return -1;
+
+    size_t free_cap = buf_free_capacity_after_purge(buf);
+    if(len <= free_cap)
+        return 0;
+
+    // double, so a stream of small writes only reallocs log(n) times
+    size_t new_size = max(buf->len * 2, buf->len + len - free_cap);
+    return buf_resize(buf, new_size);
+}
+
 /* free the buffer struct and its storage */
 int buf_destroy(buffer_t *buf)
 {
@@ -91,6 +181,11 @@ int buf_resize(buffer_t *buf, size_t new_size)
         return -1;
     }
 
+    if(is_ring(buf)) {
+        ESP_LOGE(TAG, "resizing a ring buffer unsupported");
+        return -1;
+    }
+
     size_t stale_bytes = buf_data_stale(buf);
     size_t total_bytes = buf_data_total(buf);
 
@@ -116,8 +211,7 @@ int buf_drain(buffer_t *buf, int bytes)
     if(bytes > buf_data_unread(buf))
         return -1;
 
-    buf->read_pos += bytes;
-    buf->bytes_consumed += bytes;
+    buf_consume(buf, bytes);
 
     return bytes;
 }
@@ -125,9 +219,8 @@ int buf_drain(buffer_t *buf, int bytes)
 size_t buf_drain_to(buffer_t *buf, void *to, size_t len)
 {
     size_t to_drain = min(buf_data_unread(buf), len);
-    memcpy(to, buf->read_pos, to_drain);
-    buf->read_pos += to_drain;
-    buf->bytes_consumed += to_drain;
+    buf_copy_out(buf, to, to_drain);
+    buf_consume(buf, to_drain);
 
     return to_drain;
 }
@@ -140,33 +233,45 @@ int buf_fill(buffer_t *buf, int bytes)
     if(bytes > buf_free_capacity(buf))
         return -1;
 
-    buf->write_pos += bytes;
+    buf_commit_write(buf, bytes);
 
     return bytes;
 }
 
 size_t buf_write(buffer_t *buf, const void* from, size_t len)
 {
-    size_t bytes_to_write = min(buf_free_capacity(buf), len);
+    size_t bytes_written = 0;
 
-    if(bytes_to_write == 0 && buf_free_capacity_after_purge(buf) > 0) {
-        bytes_to_write = min(buf_move_remaining_bytes_to_front(buf), len);
-    }
+    // a ring may need two rounds to write past the wrap point
+    while(bytes_written < len) {
+        size_t bytes_to_write = min(buf_free_capacity(buf), len - bytes_written);
 
-    if (bytes_to_write > 0) {
-        memcpy(buf->write_pos, from, bytes_to_write);
-        buf->write_pos += bytes_to_write;
+        if(bytes_to_write == 0 && buf_free_capacity_after_purge(buf) > 0) {
+            bytes_to_write = min(buf_move_remaining_bytes_to_front(buf), len - bytes_written);
+        }
+
+        if(bytes_to_write == 0)
+            break;
+
+        memcpy(buf->write_pos, (const uint8_t *) from + bytes_written, bytes_to_write);
+        buf_commit_write(buf, bytes_to_write);
+        bytes_written += bytes_to_write;
     }
 
-    return bytes_to_write;
+    return bytes_written;
 }
 
+/* space that can be written in one piece at write_pos */
 size_t buf_free_capacity(buffer_t *buf)
 {
     if(buf == NULL)
         return -1;
 
-    return (buf->base + buf->len) - buf->write_pos;
+    size_t to_end = (buf->base + buf->len) - buf->write_pos;
+    if(is_ring(buf))
+        return min(to_end, buf_free_capacity_after_purge(buf));
+
+    return to_end;
 }
 
 /* available unused capacity */
@@ -175,6 +280,10 @@ size_t buf_free_capacity_after_purge(buffer_t *buf)
     if(buf == NULL)
         return -1;
 
+    // one byte is kept free so that a full ring differs from an empty one
+    if(is_ring(buf))
+        return buf->len - 1 - buf_data_unread(buf);
+
     return buf_free_capacity(buf) + buf_data_stale(buf);
 }
 
@@ -184,6 +293,9 @@ size_t buf_data_total(buffer_t *buf)
     if(buf == NULL)
         return -1;
 
+    if(is_ring(buf))
+        return buf_data_unread(buf);
+
     return buf->write_pos - buf->base;
 }
 
@@ -193,14 +305,33 @@ size_t buf_data_unread(buffer_t *buf)
     if(buf == NULL)
         return -1;
 
+    if(is_ring(buf) && buf->write_pos < buf->read_pos)
+        return buf->write_pos + buf->len - buf->read_pos;
+
     return buf->write_pos - buf->read_pos;
 }
 
+/* unread bytes up to the end of the storage, including the guard */
+size_t buf_data_contiguous(buffer_t *buf)
+{
+    if(buf == NULL)
+        return -1;
+
+    if(is_ring(buf))
+        return min(buf_data_unread(buf),
+                (size_t) (buf->base + buf->len + buf->guard - buf->read_pos));
+
+    return buf_data_unread(buf);
+}
+
 /* amount of bytes already consumed */
 size_t buf_data_stale(buffer_t *buf)
 {
     if(buf == NULL) return -1;
 
+    if(is_ring(buf))
+        return 0;
+
     return buf->read_pos - buf->base;
 }
 
@@ -208,17 +339,50 @@ size_t buf_data_stale(buffer_t *buf)
 size_t fill_read_buffer(buffer_t *buf)
 {
     buf_move_remaining_bytes_to_front(buf);
-    size_t bytes_to_read = min(buf_free_capacity_after_purge(buf), spiRamFifoFill());
-
-    if (bytes_to_read > 0) {
-        spiRamFifoRead((char *) buf->write_pos, bytes_to_read);
-        buf->write_pos += bytes_to_read;
+    size_t bytes_to_read = min(buf_free_capacity_after_purge(buf), fifo_fill(buf->fifo));
+    size_t bytes_read = 0;
+
+    while (bytes_read < bytes_to_read) {
+        size_t chunk = min(buf_free_capacity(buf), bytes_to_read - bytes_read);
+        fifo_read(buf->fifo, (char *) buf->write_pos, chunk);
+        buf_commit_write(buf, chunk);
+        bytes_read += chunk;
     }
 
-    return bytes_to_read;
+    return bytes_read;
 }
 
 
+/* refill until at least need bytes are unread, sleeping on the fifo in between */
+static int buf_wait_unread(buffer_t *buf, size_t need, TickType_t deadline)
+{
+    while (1) {
+        if (buf_data_unread(buf) >= need)
+            return 0;
+
+        if (buf->fifo == NULL)
+            return BUF_ERR_EOF;
+
+        fill_read_buffer(buf);
+        size_t unread = buf_data_unread(buf);
+        if (unread >= need)
+            return 0;
+
+        int32_t remaining = (int32_t) (deadline - xTaskGetTickCount());
+        if (remaining <= 0)
+            return BUF_ERR_TIMEOUT;
+
+        switch (fifo_wait(buf->fifo, need - unread, remaining)) {
+            case FIFO_EOF:
+                return BUF_ERR_EOF;
+            case FIFO_TIMEOUT:
+                return BUF_ERR_TIMEOUT;
+            default:
+                break;
+        }
+    }
+}
+
 int buf_seek_rel(buffer_t *buf, uint32_t offset)
 {
     if (buf == NULL) return -1;
@@ -229,13 +393,19 @@ int buf_seek_rel(buffer_t *buf, uint32_t offset)
 
         // if offset exceeds buffer capacity, load more data
         if(offset > data_avail) {
-            buf->read_pos += data_avail;
+            buf_consume(buf, data_avail);
             offset -= data_avail;
-            buf->bytes_consumed += data_avail;
-            fill_read_buffer(buf);
+
+            // the deadline restarts as long as data keeps coming in
+            int err = buf_wait_unread(buf, 1,
+                    xTaskGetTickCount() + pdMS_TO_TICKS(BUF_READ_TIMEOUT_MS));
+            if (err != 0) {
+                ESP_LOGE(TAG, "buf_seek_rel failed with %u bytes left: %s", offset,
+                        err == BUF_ERR_EOF ? "eof" : "timeout");
+                return err;
+            }
         } else {
-            buf->read_pos += offset;
-            buf->bytes_consumed += offset;
+            buf_consume(buf, offset);
             break;
         }
     }
@@ -247,6 +417,11 @@ int buf_seek_abs(buffer_t *buf, uint32_t pos)
 {
     if (buf == NULL) return -1;
 
+    if(is_ring(buf)) {
+        ESP_LOGE(TAG, "buf_seek_abs unsupported on a ring buffer");
+        return -1;
+    }
+
     if(pos > buf->write_pos) {
         ESP_LOGE(TAG, "buf_seek_abs failed, pos = %u larger than fill_pos %u", pos, (uint32_t) buf->write_pos);
         return -1;
@@ -259,35 +434,36 @@ int buf_seek_abs(buffer_t *buf, uint32_t pos)
     return 0;
 }
 
-size_t buf_read(void * ptr, size_t size, size_t count, buffer_t *buf)
+int buf_read_wait(void *ptr, size_t len, buffer_t *buf, uint32_t timeout_ms)
 {
-    if(size == 0 || count == 0)
-        return 0;
-
-    size_t bytes_to_copy = size * count;
-    if(bytes_to_copy > buf->len) {
-        ESP_LOGE(TAG, "buf_read failed, bytes_to_copy = %d larger than buffer size %d", bytes_to_copy, buf->len);
-        return -1;
+    if(len > buf_data_unread(buf) + buf_free_capacity_after_purge(buf)) {
+        ESP_LOGE(TAG, "buf_read failed, bytes_to_copy = %d larger than buffer size %d", len, buf->len);
+        return BUF_ERR_INVALID;
     }
 
-    uint16_t delay = 0;
-    while(bytes_to_copy > buf_data_unread(buf) && delay < 5000) {
-        fill_read_buffer(buf);
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        delay += 50;
+    int err = buf_wait_unread(buf, len, xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms));
+    if(err != 0) {
+        ESP_LOGE(TAG, "buf_read failed bytes_to_copy %d, buf_data_unread %d: %s", len,
+                buf_data_unread(buf), err == BUF_ERR_EOF ? "eof" : "timeout");
+        return err;
     }
 
-    if(bytes_to_copy > buf_data_unread(buf)) {
-        ESP_LOGE(TAG, "buf_read failed bytes_to_copy %d, buf_data_unread %d", bytes_to_copy, buf_data_unread(buf));
-        return -1;
-    }
+    buf_copy_out(buf, ptr, len);
+    buf_consume(buf, len);
 
-    memcpy(ptr, buf->read_pos, bytes_to_copy);
+    return len;
+}
 
-    buf->read_pos += bytes_to_copy;
-    buf->bytes_consumed += bytes_to_copy;
+size_t buf_read(void * ptr, size_t size, size_t count, buffer_t *buf)
+{
+    if(size == 0 || count == 0)
+        return 0;
+
+    int bytes_read = buf_read_wait(ptr, size * count, buf, BUF_READ_TIMEOUT_MS);
+    if(bytes_read < 0)
+        return -1;
 
-    return bytes_to_copy;
+    return bytes_read;
 }
 
 
@@ -11,6 +11,8 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#include "fifo.h"
+
 #ifndef max
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #endif
@@ -18,21 +20,49 @@
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+/* how long a read waits for the stream before giving up */
+#define BUF_READ_TIMEOUT_MS 5000
+
+/* errors returned by blocking reads */
+#define BUF_ERR_EOF     -1
+#define BUF_ERR_TIMEOUT -2
+#define BUF_ERR_INVALID -3
+
 typedef struct
 {
     uint8_t *base;
     uint8_t *read_pos;
     uint8_t *write_pos;
-    uint16_t len;
+    size_t len;
+    /* ring mode if > 0: bytes mirrored behind base + len */
+    size_t guard;
     uint32_t bytes_consumed;
+    /* source for fill_read_buffer() */
+    fifo_t *fifo;
 } buffer_t;
 
 /* create a buffer on the heap */
 buffer_t *buf_create(size_t len);
 
+/**
+ * Create a ring buffer on the heap. Reading never has to move data to the
+ * front, and up to guard bytes at read_pos are always contiguous, so guard
+ * should cover the largest frame the reader has to see in one piece.
+ */
+buffer_t *buf_create_ring(size_t len, size_t guard);
+
 /* wraps an existing buffer */
 buffer_t *buf_wrap(void *existing, size_t len);
 
+/* like buf_wrap(), but initializes a caller owned struct, e.g. on the stack */
+buffer_t *buf_init(buffer_t *buf, void *existing, size_t len);
+
+/* discard all data, keeps the storage */
+void buf_reset(buffer_t *buf);
+
+/* make sure at least len bytes can be written, growing geometrically */
+int buf_reserve(buffer_t *buf, size_t len);
+
 /* free the backing storage, and the struct itself */
 int buf_destroy(buffer_t *buf);
 
@@ -49,7 +79,9 @@ size_t buf_drain_to(buffer_t *buf, void *to, size_t len);
 int buf_fill(buffer_t *buf, int bytes);
 
 /**
- * Seek from the current position of the pointer.
+ * Seek from the current position of the pointer. Waits for the fifo if the
+ * target lies beyond the buffered data, returns BUF_ERR_EOF or
+ * BUF_ERR_TIMEOUT if it can't be reached.
  */
 int buf_seek_rel(buffer_t *buf, uint32_t pos);
 
@@ -70,6 +102,9 @@ size_t buf_data_total(buffer_t *buf);
 /* bytes left to be consumed */
 size_t buf_data_unread(buffer_t *buf);
 
+/* unread bytes that can be accessed in one piece at read_pos */
+size_t buf_data_contiguous(buffer_t *buf);
+
 /* stale bytes that have already been consumed */
 size_t buf_data_stale(buffer_t *buf);
 
@@ -87,6 +122,14 @@ size_t buf_data_stale(buffer_t *buf);
  */
 size_t buf_read( void * ptr, size_t size, size_t count, buffer_t *buf);
 
+/**
+ * Reads exactly len bytes, sleeping on the fifo until they have arrived.
+ * Returns len, or BUF_ERR_EOF if the stream ended first, BUF_ERR_TIMEOUT if
+ * the data didn't arrive within timeout_ms, BUF_ERR_INVALID if len exceeds
+ * the buffer capacity. Nothing is consumed on error.
+ */
+int buf_read_wait(void *ptr, size_t len, buffer_t *buf, uint32_t timeout_ms);
+
 uint16_t fread16(buffer_t *buf, size_t position);
 uint32_t fread32(buffer_t *buf, size_t position);
 
@@ -18,6 +18,8 @@
 #include "common_buffer.h"
 #include "aacdecoder_lib.h"
 #include "audio_player.h"
+#include "bitrate.h"
+#include "codec.h"
 #include "m4a.h"
 
 #define TAG "fdkaac_decoder"
@@ -31,22 +33,62 @@ static const uint32_t INPUT_BUFFER_SIZE = 1024;
 #define OUTPUT_BUFFER_SIZE  (MAX_FRAME_SIZE * sizeof(INT_PCM) * MAX_CHANNELS)
 
 
-void fdkaac_decoder_task(void *pvParameters)
+/* state of one renderer source, the dialog and the content worker decode
+ * at the same time */
+typedef struct {
+    /* allocated with the first stream, reused by all others */
+    buffer_t *pcm_buf;
+    buffer_t *in_buf;
+
+    /* state of the current stream */
+    HANDLE_AACDECODER handle;
+    pcm_format_t pcm_format;
+    uint32_t pcm_size;
+    bool first_frame;
+} fdkaac_state_t;
+
+static fdkaac_state_t states[RENDERER_SOURCE_COUNT];
+
+static int alloc_buffers(fdkaac_state_t *st)
+{
+    /* allocate sample buffer */
+    if (st->pcm_buf == NULL)
+        st->pcm_buf = buf_create(OUTPUT_BUFFER_SIZE);
+
+    /* allocate bitstream buffer */
+    if (st->in_buf == NULL)
+        st->in_buf = buf_create(INPUT_BUFFER_SIZE);
+
+    if (st->pcm_buf == NULL || st->in_buf == NULL) {
+        ESP_LOGE(TAG, "couldn't allocate buffers");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* finds the first ADTS frame */
+static int fdkaac_probe(const uint8_t *data, size_t len)
+{
+    return find_frame(data, len, AUDIO_AAC);
+}
+
+static int fdkaac_open(player_t *player)
 {
+    fdkaac_state_t *st = &states[player->source];
+
     // ESP_LOGI(TAG, "(line %u) free heap: %u", __LINE__, esp_get_free_heap_size());
 
-    player_t *player = pvParameters;
     AAC_DECODER_ERROR err;
 
-    /* allocate sample buffer */
-    buffer_t *pcm_buf = buf_create(OUTPUT_BUFFER_SIZE);
+    st->handle = NULL;
 
-    /* allocate bitstream buffer */
-    buffer_t *in_buf = buf_create(INPUT_BUFFER_SIZE);
-    fill_read_buffer(in_buf);
+    if (alloc_buffers(st) != 0)
+        return -1;
 
-    HANDLE_AACDECODER handle = NULL;
-    pcm_format_t pcm_format = {.buffer_format = PCM_INTERLEAVED};
+    buf_reset(st->in_buf);
+    st->in_buf->fifo = player->fifo;
+    fill_read_buffer(st->in_buf);
 
     /* select bitstream format */
     if (player->media_stream->content_type == AUDIO_MP4) {
@@ -55,73 +97,87 @@ void fdkaac_decoder_task(void *pvParameters)
         stream_t input_stream;
         memset(&demux_res, 0, sizeof(demux_res));
 
-        stream_create(&input_stream, in_buf);
-        fill_read_buffer(in_buf);
+        stream_create(&input_stream, st->in_buf);
+        fill_read_buffer(st->in_buf);
 
         if (!qtmovie_read(&input_stream, &demux_res)) {
             ESP_LOGE(TAG, "qtmovie_read failed");
-            goto cleanup;
+            return -1;
         } else {
             ESP_LOGI(TAG, "qtmovie_read success");
         }
 
         /* create decoder instance */
-        handle = aacDecoder_Open(TT_MP4_RAW, /* num layers */1);
-        if (handle == NULL) {
+        st->handle = aacDecoder_Open(TT_MP4_RAW, /* num layers */1);
+        if (st->handle == NULL) {
             ESP_LOGE(TAG, "malloc failed %d", __LINE__);
-            goto cleanup;
+            return -1;
         }
 
         // If out-of-band config data (AudioSpecificConfig(ASC) or StreamMuxConfig(SMC)) is available
         uint8_t ascData[1] = {demux_res.codecdata};
         const uint32_t ascDataLen[1] = {demux_res.codecdata_len};
-        err = aacDecoder_ConfigRaw(handle, &demux_res.codecdata, &demux_res.codecdata_len);
+        err = aacDecoder_ConfigRaw(st->handle, &demux_res.codecdata, &demux_res.codecdata_len);
         if (err != AAC_DEC_OK) {
             ESP_LOGE(TAG, "aacDecoder_ConfigRaw error %d", err);
-            goto cleanup;
+            return -1;
         }
 
     } else {
         /* create decoder instance */
-        handle = aacDecoder_Open(TT_MP4_ADTS, /* num layers */1);
-        if (handle == NULL) {
+        st->handle = aacDecoder_Open(TT_MP4_ADTS, /* num layers */1);
+        if (st->handle == NULL) {
             ESP_LOGE(TAG, "malloc failed %d", __LINE__);
-            goto cleanup;
+            return -1;
         }
     }
 
     /* configure instance */
-    aacDecoder_SetParam(handle, AAC_PCM_OUTPUT_INTERLEAVED, 1);
-    aacDecoder_SetParam(handle, AAC_PCM_MIN_OUTPUT_CHANNELS, 2);
-    aacDecoder_SetParam(handle, AAC_PCM_MAX_OUTPUT_CHANNELS, 2);
-    aacDecoder_SetParam(handle, AAC_PCM_LIMITER_ENABLE, 0);
+    aacDecoder_SetParam(st->handle, AAC_PCM_OUTPUT_INTERLEAVED, 1);
+    aacDecoder_SetParam(st->handle, AAC_PCM_MIN_OUTPUT_CHANNELS, 2);
+    aacDecoder_SetParam(st->handle, AAC_PCM_MAX_OUTPUT_CHANNELS, 2);
+    aacDecoder_SetParam(st->handle, AAC_PCM_LIMITER_ENABLE, 0);
 
-    const uint32_t flags = 0;
-    uint32_t pcm_size = 0;
-    bool first_frame = true;
+    st->pcm_size = 0;
+    st->first_frame = true;
+    st->pcm_format.buffer_format = PCM_INTERLEAVED;
 
     ESP_LOGI(TAG, "(line %u) free heap: %u", __LINE__, esp_get_free_heap_size());
 
-    while (!player->media_stream->eof) {
+    return 0;
+}
+
+static int fdkaac_decode_frame(player_t *player)
+{
+    fdkaac_state_t *st = &states[player->source];
+    const uint32_t flags = 0;
+    AAC_DECODER_ERROR err;
+
+    while (player->decoder_command != CMD_STOP) {
 
         /* re-fill buffer if necessary */
-        if (buf_data_unread(in_buf) == 0) {
-            fill_read_buffer(in_buf);
+        if (buf_data_unread(st->in_buf) == 0) {
+            fill_read_buffer(st->in_buf);
         }
 
         // bytes_avail will be updated and indicate "how much data is left"
-        size_t bytes_avail = buf_data_unread(in_buf);
-        aacDecoder_Fill(handle, &in_buf->read_pos, &bytes_avail, &bytes_avail);
+        size_t bytes_avail = buf_data_unread(st->in_buf);
+        aacDecoder_Fill(st->handle, &st->in_buf->read_pos, &bytes_avail, &bytes_avail);
 
-        uint32_t bytes_taken = buf_data_unread(in_buf) - bytes_avail;
-        buf_seek_rel(in_buf, bytes_taken);
+        uint32_t bytes_taken = buf_data_unread(st->in_buf) - bytes_avail;
+        buf_seek_rel(st->in_buf, bytes_taken);
 
 
-        err = aacDecoder_DecodeFrame(handle, (short int *) pcm_buf->base,
-                pcm_buf->len, flags);
+        err = aacDecoder_DecodeFrame(st->handle, (short int *) st->pcm_buf->base,
+                st->pcm_buf->len, flags);
 
         // need more bytes, lets refill
         if(err == AAC_DEC_TRANSPORT_SYNC_ERROR || err == AAC_DEC_NOT_ENOUGH_BITS) {
+            // the whole stream went through the decoder
+            if (player->media_stream->eof && buf_data_unread(st->in_buf) == 0
+                    && fifo_fill(player->fifo) == 0) {
+                break;
+            }
             continue;
         }
 
@@ -131,38 +187,51 @@ void fdkaac_decoder_task(void *pvParameters)
         }
 
         /* print first frame, determine pcm buffer length */
-        if(first_frame) {
-            first_frame = false;
+        if(st->first_frame) {
+            st->first_frame = false;
 
-            CStreamInfo* mStreamInfo = aacDecoder_GetStreamInfo(handle);
+            CStreamInfo* mStreamInfo = aacDecoder_GetStreamInfo(st->handle);
 
-            pcm_size = mStreamInfo->frameSize * sizeof(int16_t)
+            st->pcm_size = mStreamInfo->frameSize * sizeof(int16_t)
                     * mStreamInfo->numChannels;
 
-            ESP_LOGI(TAG, "pcm_size %d, channels: %d, sample rate: %d, object type: %d, bitrate: %d", pcm_size, mStreamInfo->numChannels,
+            ESP_LOGI(TAG, "pcm_size %d, channels: %d, sample rate: %d, object type: %d, bitrate: %d", st->pcm_size, mStreamInfo->numChannels,
                     mStreamInfo->sampleRate, mStreamInfo->aot, mStreamInfo->bitRate);
 
-            pcm_format.bit_depth = I2S_BITS_PER_SAMPLE_16BIT;
-            pcm_format.num_channels = mStreamInfo->numChannels;
-            pcm_format.sample_rate = mStreamInfo->sampleRate;
+            st->pcm_format.bit_depth = I2S_BITS_PER_SAMPLE_16BIT;
+            st->pcm_format.num_channels = mStreamInfo->numChannels;
+            st->pcm_format.sample_rate = mStreamInfo->sampleRate;
         }
 
-        render_samples((const char *) pcm_buf->base, pcm_size, &pcm_format);
+        render_source_samples(player->source, (char *) st->pcm_buf->base, st->pcm_size,
+                &st->pcm_format);
 
         // ESP_LOGI(TAG, "fdk_aac_decoder stack: %d\n", uxTaskGetStackHighWaterMark(NULL));
         // ESP_LOGI(TAG, "%u free heap %u", __LINE__, esp_get_free_heap_size());
 
         // about 32K free heap at this point
+        return CODEC_OK;
     }
 
-    cleanup:
+    return CODEC_EOF;
+}
 
-    buf_destroy(in_buf);
-    buf_destroy(pcm_buf);
+static void fdkaac_close(player_t *player)
+{
+    fdkaac_state_t *st = &states[player->source];
 
-    aacDecoder_Close(handle);
+    aacDecoder_Close(st->handle);
+    st->handle = NULL;
 
     ESP_LOGI(TAG, "aac decoder finished");
-
-    vTaskDelete(NULL);
 }
+
+const codec_t codec_aac = {
+    .name = "aac",
+    .content_type = AUDIO_AAC,
+    .stack_size = 6144,
+    .probe = fdkaac_probe,
+    .open = fdkaac_open,
+    .decode_frame = fdkaac_decode_frame,
+    .close = fdkaac_close
+};
@@ -8,6 +8,9 @@
 #ifndef _INCLUDE_FDK_AAC_DECODER_H_
 #define _INCLUDE_FDK_AAC_DECODER_H_
 
-void fdkaac_decoder_task(void *pvParameters);
+#include "codec.h"
+
+/* ADTS framed AAC, fdk-aac */
+extern const codec_t codec_aac;
 
 #endif /* _INCLUDE_FDK_AAC_DECODER_H_ */
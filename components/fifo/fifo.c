@@ -0,0 +1,655 @@
+/*
+ * fifo.c
+ *
+ * Lock-free single-producer / single-consumer FIFO, backed by internal RAM
+ * or by a region of the SPI RAM chip. Any number of instances can exist,
+ * each media stream owns its own.
+ *
+ * The writer only ever advances wpos, the reader only ever advances rpos.
+ * Both indices run from 0 to 2*size so that a full and an empty buffer can
+ * be told apart without sacrificing a slot. The semaphores are only touched
+ * when one side actually has to sleep because the FIFO is empty or full.
+ *
+ * fifo_reserve/fifo_commit and fifo_peek_contiguous/fifo_consume give direct
+ * access to the ring memory. A frame straddling the wrap point is made
+ * contiguous by copying its head into a mirror region behind the end of the
+ * buffer, so a consumer can always look at FIFO_MIRROR_SIZE bytes in one
+ * piece. SPI RAM can't be addressed directly, so those instances go through
+ * bounce buffers instead.
+ *
+ * Each instance collects telemetry for sizing buffers and start thresholds:
+ * the consumer samples the fill level into a histogram whenever it takes
+ * data, and both sides log the moment they start starving or stalling.
+ *
+ *  Created on: 21.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "fifo.h"
+#include "spiram.h"
+#include "playerconfig.h"
+
+#define TAG "fifo"
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+struct fifo {
+    fifo_backing_t backing;
+    uint32_t size;
+
+    /* FIFO_BACKING_RAM: size + FIFO_MIRROR_SIZE bytes */
+    char *mem;
+
+    /* FIFO_BACKING_SPIRAM: start address on the chip */
+    uint32_t spiram_addr;
+    char *read_bounce;
+    char *write_bounce;
+    /* read_bounce holds bounce_len bytes starting at index bounce_rpos */
+    uint32_t bounce_rpos;
+    uint32_t bounce_len;
+
+    /* read/write indices, range 0 .. 2 * size - 1 */
+    uint32_t rpos;
+    uint32_t wpos;
+
+    /* set by a side that is about to sleep, cleared by the side that wakes it */
+    uint32_t reader_waiting;
+    uint32_t writer_waiting;
+
+    /* no more data will be written */
+    uint32_t eof;
+
+    SemaphoreHandle_t can_read;
+    SemaphoreHandle_t can_write;
+
+    /* each counter is only ever written by one side */
+    volatile long overrun_cnt;
+    volatile long underrun_cnt;
+
+    /* telemetry, see fifo_stats_t */
+    fifo_stats_t stats;
+    /* only log the first event of an episode */
+    bool reader_starved;
+    bool writer_stalled;
+
+    /* fifo_reset() counts up, the writer clears its own telemetry when it
+     * sees a count it hasn't caught up with */
+    volatile uint32_t reset_epoch;
+    uint32_t writer_epoch;
+};
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define load_seq(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define store_seq(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define take_flag(p) __atomic_exchange_n((p), 0, __ATOMIC_SEQ_CST)
+
+/* SPI RAM is handed out in order, regions are never returned */
+static uint32_t spiram_next_addr = 0;
+
+static inline uint32_t fifo_used(fifo_t *fifo, uint32_t rpos, uint32_t wpos)
+{
+    return (wpos >= rpos) ? wpos - rpos : wpos + 2 * fifo->size - rpos;
+}
+
+static inline uint32_t fifo_advance(fifo_t *fifo, uint32_t pos, uint32_t n)
+{
+    pos += n;
+    if (pos >= 2 * fifo->size) pos -= 2 * fifo->size;
+    return pos;
+}
+
+/* physical offset in the backing store */
+static inline uint32_t fifo_offset(fifo_t *fifo, uint32_t pos)
+{
+    return (pos >= fifo->size) ? pos - fifo->size : pos;
+}
+
+static void store_read(fifo_t *fifo, uint32_t off, char *buff, uint32_t len)
+{
+    if (fifo->backing == FIFO_BACKING_RAM) {
+        memcpy(buff, fifo->mem + off, len);
+        return;
+    }
+
+#ifndef FAKE_SPI_BUFF
+    spiRamRead(fifo->spiram_addr + off, buff, len);
+#endif
+}
+
+static void store_write(fifo_t *fifo, uint32_t off, const char *buff, uint32_t len)
+{
+    if (fifo->backing == FIFO_BACKING_RAM) {
+        memcpy(fifo->mem + off, buff, len);
+        return;
+    }
+
+#ifndef FAKE_SPI_BUFF
+    spiRamWrite(fifo->spiram_addr + off, (char *) buff, len);
+#endif
+}
+
+/* each log has a single writer */
+static void log_event(fifo_t *fifo, fifo_event_log_t *log)
+{
+    fifo_event_t *evt = &log->events[log->cnt % FIFO_EVENT_LOG_SIZE];
+
+    evt->timestamp = esp_log_timestamp();
+    evt->fill = fifo_used(fifo, load_acquire(&fifo->rpos), load_acquire(&fifo->wpos));
+    log->cnt++;
+}
+
+/* reader side, call whenever the reader finds nothing to read */
+static void note_underrun(fifo_t *fifo)
+{
+    fifo->underrun_cnt++;
+    if (!fifo->reader_starved) {
+        fifo->reader_starved = true;
+        log_event(fifo, &fifo->stats.underruns);
+    }
+}
+
+/* writer side, starts over after a fifo_reset() */
+static void sync_writer_stats(fifo_t *fifo)
+{
+    uint32_t epoch = fifo->reset_epoch;
+    if (fifo->writer_epoch == epoch)
+        return;
+
+    fifo->overrun_cnt = 0;
+    fifo->stats.bytes_written = 0;
+    memset(&fifo->stats.overruns, 0, sizeof(fifo->stats.overruns));
+    fifo->writer_stalled = false;
+    fifo->writer_epoch = epoch;
+}
+
+/* writer side, call whenever the writer finds no room */
+static void note_overrun(fifo_t *fifo)
+{
+    sync_writer_stats(fifo);
+    fifo->overrun_cnt++;
+    if (!fifo->writer_stalled) {
+        fifo->writer_stalled = true;
+        log_event(fifo, &fifo->stats.overruns);
+    }
+}
+
+/* reader side, fill is the level before n bytes are taken */
+static void note_read(fifo_t *fifo, uint32_t fill, uint32_t n)
+{
+    fifo_stats_t *stats = &fifo->stats;
+    uint32_t bucket = fill * FIFO_HIST_BUCKETS / fifo->size;
+
+    stats->fill_hist[min(bucket, FIFO_HIST_BUCKETS - 1)]++;
+    if (fill < stats->min_fill) stats->min_fill = fill;
+    if (fill > stats->max_fill) stats->max_fill = fill;
+    stats->bytes_read += n;
+    fifo->reader_starved = false;
+}
+
+/* writer side */
+static void note_write(fifo_t *fifo, uint32_t n)
+{
+    sync_writer_stats(fifo);
+    fifo->stats.bytes_written += n;
+    fifo->writer_stalled = false;
+}
+
+static void clear_stats(fifo_t *fifo)
+{
+    memset(&fifo->stats, 0, sizeof(fifo->stats));
+    fifo->stats.size = fifo->size;
+    fifo->stats.since = esp_log_timestamp();
+    fifo->stats.min_fill = fifo->size;
+    fifo->reader_starved = false;
+    fifo->writer_stalled = false;
+}
+
+/* Sleep until the writer has produced at least need bytes, or has signalled
+ * EOF. The flag is published before the fill level is re-checked, so a write
+ * racing with us will see it and give. The writer gives on every commit, so a
+ * larger need may take several wakeups. */
+static void wait_can_read(fifo_t *fifo, uint32_t need, TickType_t timeout)
+{
+    store_seq(&fifo->reader_waiting, 1);
+    if (fifo_used(fifo, fifo->rpos, load_seq(&fifo->wpos)) < need
+            && !load_seq(&fifo->eof)) {
+        xSemaphoreTake(fifo->can_read, timeout);
+    }
+    store_seq(&fifo->reader_waiting, 0);
+}
+
+static void wait_can_write(fifo_t *fifo)
+{
+    store_seq(&fifo->writer_waiting, 1);
+    if (fifo_used(fifo, load_seq(&fifo->rpos), fifo->wpos) == fifo->size) {
+        xSemaphoreTake(fifo->can_write, portMAX_DELAY);
+    }
+    store_seq(&fifo->writer_waiting, 0);
+}
+
+static inline void wake_reader(fifo_t *fifo)
+{
+    if (take_flag(&fifo->reader_waiting)) xSemaphoreGive(fifo->can_read);
+}
+
+static inline void wake_writer(fifo_t *fifo)
+{
+    if (take_flag(&fifo->writer_waiting)) xSemaphoreGive(fifo->can_write);
+}
+
+/* Initialize the SPI RAM chip communications and see if it actually retains
+ * some bytes. */
+int fifo_init()
+{
+#ifdef FAKE_SPI_BUFF
+    return 1;
+#else
+    spiRamInit();
+    return spiRamTest();
+#endif
+}
+
+fifo_t *fifo_create(size_t size, fifo_backing_t backing)
+{
+    fifo_t *fifo = calloc(1, sizeof(fifo_t));
+    if (fifo == NULL) {
+        ESP_LOGE(TAG, "couldn't allocate fifo");
+        return NULL;
+    }
+
+#ifdef FAKE_SPI_BUFF
+    backing = FIFO_BACKING_RAM;
+#endif
+
+    fifo->size = size;
+    fifo->backing = backing;
+
+    if (backing == FIFO_BACKING_RAM) {
+        fifo->mem = malloc(size + FIFO_MIRROR_SIZE);
+    } else if (spiram_next_addr + size <= SPIRAMSIZE) {
+        fifo->spiram_addr = spiram_next_addr;
+        spiram_next_addr += size;
+        fifo->read_bounce = malloc(FIFO_MIRROR_SIZE);
+        fifo->write_bounce = malloc(FIFO_MIRROR_SIZE);
+    } else {
+        ESP_LOGE(TAG, "SPI RAM exhausted, %u bytes requested", size);
+    }
+
+    clear_stats(fifo);
+
+    fifo->can_read = xSemaphoreCreateBinary();
+    fifo->can_write = xSemaphoreCreateBinary();
+
+    bool storage_ok = (backing == FIFO_BACKING_RAM) ?
+            fifo->mem != NULL : (fifo->read_bounce != NULL && fifo->write_bounce != NULL);
+
+    if (!storage_ok || fifo->can_read == NULL || fifo->can_write == NULL) {
+        ESP_LOGE(TAG, "couldn't allocate fifo of size %u", size);
+        fifo_destroy(fifo);
+        return NULL;
+    }
+
+    return fifo;
+}
+
+void fifo_destroy(fifo_t *fifo)
+{
+    if (fifo == NULL)
+        return;
+
+    if (fifo->can_read != NULL) vSemaphoreDelete(fifo->can_read);
+    if (fifo->can_write != NULL) vSemaphoreDelete(fifo->can_write);
+
+    free(fifo->mem);
+    free(fifo->read_bounce);
+    free(fifo->write_bounce);
+    free(fifo);
+}
+
+/* the reader's telemetry, the writer's follows with its next write */
+static void clear_reader_stats(fifo_t *fifo)
+{
+    fifo_stats_t *stats = &fifo->stats;
+
+    memset(stats->fill_hist, 0, sizeof(stats->fill_hist));
+    memset(&stats->underruns, 0, sizeof(stats->underruns));
+    stats->since = esp_log_timestamp();
+    stats->min_fill = fifo->size;
+    stats->max_fill = 0;
+    stats->bytes_read = 0;
+    fifo->underrun_cnt = 0;
+    fifo->reader_starved = false;
+
+    store_seq(&fifo->reset_epoch, fifo->reset_epoch + 1);
+}
+
+/* Discard all buffered data. Must be called from the reader side, or while
+ * no reader runs: it only moves the read index and touches what the reader
+ * owns, so a concurrent writer is not disturbed. */
+void fifo_reset(fifo_t *fifo)
+{
+    store_seq(&fifo->rpos, load_acquire(&fifo->wpos));
+    fifo->bounce_len = 0;
+    clear_reader_stats(fifo);
+    wake_writer(fifo);
+}
+
+void fifo_read(fifo_t *fifo, char *buff, int len)
+{
+    uint32_t rpos = fifo->rpos;
+    uint32_t n, fill, off;
+
+    // a peek after this read fetches everything again
+    fifo->bounce_len = 0;
+
+    while (len > 0) {
+        fill = fifo_used(fifo, rpos, load_acquire(&fifo->wpos));
+        if (fill == 0) {
+            // no data in FIFO, wait till there's some written and try again
+            note_underrun(fifo);
+            wait_can_read(fifo, 1, portMAX_DELAY);
+            continue;
+        }
+
+        // don't read past end of buffer
+        off = fifo_offset(fifo, rpos);
+        n = min(len, fill);
+        n = min(n, fifo->size - off);
+
+        store_read(fifo, off, buff, n);
+        note_read(fifo, fill, n);
+        buff += n;
+        len -= n;
+        rpos = fifo_advance(fifo, rpos, n);
+        store_seq(&fifo->rpos, rpos);
+
+        wake_writer(fifo);
+    }
+}
+
+void fifo_write(fifo_t *fifo, const char *buff, int len)
+{
+    uint32_t wpos = fifo->wpos;
+    uint32_t n, room, off;
+
+    while (len > 0) {
+        room = fifo->size - fifo_used(fifo, load_acquire(&fifo->rpos), wpos);
+        if (room == 0) {
+            // no free room in FIFO, wait till there's some read and try again
+            note_overrun(fifo);
+            wait_can_write(fifo);
+            continue;
+        }
+
+        // don't write past end of buffer
+        off = fifo_offset(fifo, wpos);
+        n = min(len, room);
+        n = min(n, fifo->size - off);
+
+        store_write(fifo, off, buff, n);
+        note_write(fifo, n);
+        buff += n;
+        len -= n;
+        wpos = fifo_advance(fifo, wpos, n);
+        store_seq(&fifo->wpos, wpos);
+
+        wake_reader(fifo);
+    }
+}
+
+fifo_wait_result_t fifo_wait(fifo_t *fifo, int len, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed;
+
+    // a request larger than the FIFO could never be satisfied
+    len = min(len, fifo->size);
+
+    while (fifo_fill(fifo) < len) {
+        if (load_seq(&fifo->eof)) {
+            // one more look, the last commit may have raced with the flag
+            return (fifo_fill(fifo) < len) ? FIFO_EOF : FIFO_OK;
+        }
+
+        elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return FIFO_TIMEOUT;
+        }
+
+        note_underrun(fifo);
+        wait_can_read(fifo, len, timeout - elapsed);
+    }
+
+    return FIFO_OK;
+}
+
+void fifo_set_eof(fifo_t *fifo, bool eof)
+{
+    store_seq(&fifo->eof, eof);
+    if (eof) wake_reader(fifo);
+}
+
+bool fifo_eof(fifo_t *fifo)
+{
+    return load_seq(&fifo->eof);
+}
+
+/* Returns a pointer to contiguous unread data, its length is stored in *len.
+ * Never blocks, returns NULL if the FIFO is empty. */
+char *fifo_peek_contiguous(fifo_t *fifo, int *len)
+{
+    uint32_t off = fifo_offset(fifo, fifo->rpos);
+    uint32_t fill = fifo_used(fifo, fifo->rpos, load_acquire(&fifo->wpos));
+    uint32_t n = min(fill, fifo->size - off);
+
+    if (fill == 0) {
+        note_underrun(fifo);
+    }
+
+    if (fifo->backing == FIFO_BACKING_RAM) {
+        // data straddles the wrap point, mirror the head behind the end
+        if (n < fill && n < FIFO_MIRROR_SIZE) {
+            uint32_t wrapped = min(fill - n, FIFO_MIRROR_SIZE - n);
+            memcpy(fifo->mem + fifo->size, fifo->mem, wrapped);
+            n += wrapped;
+        }
+
+        *len = n;
+        return (n > 0) ? fifo->mem + off : NULL;
+    }
+
+    fill = min(fill, FIFO_MIRROR_SIZE);
+
+    // keep what the last peek fetched and hasn't been consumed since, unread
+    // bytes can't have been overwritten
+    uint32_t keep = 0;
+    uint32_t consumed = fifo_used(fifo, fifo->bounce_rpos, fifo->rpos);
+    if (consumed <= fifo->bounce_len) {
+        keep = min(fifo->bounce_len - consumed, fill);
+        memmove(fifo->read_bounce, fifo->read_bounce + consumed, keep);
+    }
+
+    // fetch the rest, it may straddle the wrap point
+    off = fifo_offset(fifo, fifo_advance(fifo, fifo->rpos, keep));
+    n = min(fill - keep, fifo->size - off);
+    store_read(fifo, off, fifo->read_bounce + keep, n);
+    store_read(fifo, 0, fifo->read_bounce + keep + n, fill - keep - n);
+
+    fifo->bounce_rpos = fifo->rpos;
+    fifo->bounce_len = fill;
+
+    *len = fill;
+    return (fill > 0) ? fifo->read_bounce : NULL;
+}
+
+/* Releases n bytes previously obtained by fifo_peek_contiguous(). */
+void fifo_consume(fifo_t *fifo, int n)
+{
+    note_read(fifo, fifo_used(fifo, fifo->rpos, load_acquire(&fifo->wpos)), n);
+    store_seq(&fifo->rpos, fifo_advance(fifo, fifo->rpos, n));
+    wake_writer(fifo);
+}
+
+/* at most len of the room bytes, as far as they are contiguous */
+static char *reserve_room(fifo_t *fifo, int len, uint32_t room, int *avail)
+{
+    uint32_t off = fifo_offset(fifo, fifo->wpos);
+    uint32_t n;
+
+    n = min(len, room);
+    n = min(n, fifo->size - off);
+
+    if (fifo->backing == FIFO_BACKING_RAM) {
+        *avail = n;
+        return fifo->mem + off;
+    }
+
+    *avail = min(n, FIFO_MIRROR_SIZE);
+    return fifo->write_bounce;
+}
+
+/* Returns a pointer to at most len contiguous free bytes, the actual amount is
+ * stored in *avail. Blocks while the FIFO is full. */
+char *fifo_reserve(fifo_t *fifo, int len, int *avail)
+{
+    uint32_t room;
+
+    while ((room = fifo->size - fifo_used(fifo, load_acquire(&fifo->rpos), fifo->wpos)) == 0) {
+        note_overrun(fifo);
+        wait_can_write(fifo);
+    }
+
+    return reserve_room(fifo, len, room, avail);
+}
+
+char *fifo_try_reserve(fifo_t *fifo, int len, int *avail)
+{
+    uint32_t room = fifo->size - fifo_used(fifo, load_acquire(&fifo->rpos), fifo->wpos);
+
+    if (room == 0) {
+        note_overrun(fifo);
+        *avail = 0;
+        return NULL;
+    }
+
+    return reserve_room(fifo, len, room, avail);
+}
+
+/* Publishes n bytes written into the area returned by fifo_reserve(). */
+void fifo_commit(fifo_t *fifo, int n)
+{
+    if (fifo->backing == FIFO_BACKING_SPIRAM) {
+        store_write(fifo, fifo_offset(fifo, fifo->wpos), fifo->write_bounce, n);
+    }
+
+    note_write(fifo, n);
+    store_seq(&fifo->wpos, fifo_advance(fifo, fifo->wpos, n));
+    wake_reader(fifo);
+}
+
+int fifo_fill(fifo_t *fifo)
+{
+    return fifo_used(fifo, load_acquire(&fifo->rpos), load_acquire(&fifo->wpos));
+}
+
+int fifo_free(fifo_t *fifo)
+{
+    return fifo->size - fifo_fill(fifo);
+}
+
+int fifo_len(fifo_t *fifo)
+{
+    return fifo->size;
+}
+
+long fifo_overrun_count(fifo_t *fifo)
+{
+    return fifo->overrun_cnt;
+}
+
+long fifo_underrun_count(fifo_t *fifo)
+{
+    return fifo->underrun_cnt;
+}
+
+uint32_t fifo_underrun_episodes(fifo_t *fifo)
+{
+    return fifo->stats.underruns.cnt;
+}
+
+void fifo_get_stats(fifo_t *fifo, fifo_stats_t *stats)
+{
+    memcpy(stats, &fifo->stats, sizeof(fifo_stats_t));
+    stats->overrun_cnt = fifo->overrun_cnt;
+    stats->underrun_cnt = fifo->underrun_cnt;
+
+    // the writer hasn't written since the last reset, what it has is stale
+    if (fifo->writer_epoch != fifo->reset_epoch) {
+        stats->overrun_cnt = 0;
+        stats->bytes_written = 0;
+        memset(&stats->overruns, 0, sizeof(stats->overruns));
+    }
+}
+
+/* oldest first */
+static void dump_events(const char *name, const char *what, fifo_event_log_t *log)
+{
+    uint32_t first = (log->cnt > FIFO_EVENT_LOG_SIZE) ? log->cnt - FIFO_EVENT_LOG_SIZE : 0;
+
+    for (uint32_t i = first; i < log->cnt; i++) {
+        fifo_event_t *evt = &log->events[i % FIFO_EVENT_LOG_SIZE];
+        ESP_LOGI(TAG, "%s: %s %u at %u ms, fill %u", name, what, i, evt->timestamp, evt->fill);
+    }
+}
+
+void fifo_dump_stats(fifo_t *fifo, const char *name)
+{
+    fifo_stats_t stats;
+    fifo_get_stats(fifo, &stats);
+
+    uint32_t now = esp_log_timestamp();
+    uint32_t elapsed_ms = max(now - stats.since, 1);
+    uint32_t samples = 0;
+    for (int i = 0; i < FIFO_HIST_BUCKETS; i++) {
+        samples += stats.fill_hist[i];
+    }
+
+    ESP_LOGI(TAG, "%s: size %u, %u ms, fill min %u max %u now %d", name, stats.size,
+            elapsed_ms, (samples > 0) ? stats.min_fill : 0, stats.max_fill, fifo_fill(fifo));
+    ESP_LOGI(TAG, "%s: in %llu bytes (%llu B/s), out %llu bytes (%llu B/s)", name,
+            stats.bytes_written, stats.bytes_written * 1000 / elapsed_ms,
+            stats.bytes_read, stats.bytes_read * 1000 / elapsed_ms);
+    ESP_LOGI(TAG, "%s: %ld underruns in %u episodes, %ld overruns in %u episodes", name,
+            stats.underrun_cnt, stats.underruns.cnt, stats.overrun_cnt, stats.overruns.cnt);
+
+    for (int i = 0; i < FIFO_HIST_BUCKETS; i++) {
+        ESP_LOGI(TAG, "%s: fill %3d-%3d%%: %3u%% (%u)", name,
+                i * 100 / FIFO_HIST_BUCKETS, (i + 1) * 100 / FIFO_HIST_BUCKETS,
+                (samples > 0) ? (uint32_t) ((uint64_t) stats.fill_hist[i] * 100 / samples) : 0,
+                stats.fill_hist[i]);
+    }
+
+#ifndef FAKE_SPI_BUFF
+    if (fifo->backing == FIFO_BACKING_SPIRAM) {
+        ESP_LOGI(TAG, "%s: %u SPI RAM transactions since boot", name, spiRamTransactionCount());
+    }
+#endif
+
+    dump_events(name, "underrun", &stats.underruns);
+    dump_events(name, "overrun", &stats.overruns);
+}
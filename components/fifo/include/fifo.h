@@ -0,0 +1,126 @@
+/*
+ * fifo.h
+ *
+ *  Created on: 21.06.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef _INCLUDE_FIFO_H_
+#define _INCLUDE_FIFO_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* largest piece fifo_peek_contiguous() guarantees to return unsplit, must
+ * cover the largest frame any decoder reads straight from the FIFO */
+#define FIFO_MIRROR_SIZE (3 * 1024)
+
+typedef enum {
+    FIFO_BACKING_RAM, FIFO_BACKING_SPIRAM
+} fifo_backing_t;
+
+/* fill level histogram resolution, each bucket covers an equal share */
+#define FIFO_HIST_BUCKETS 10
+
+/* most recent underrun and overrun events kept per FIFO, each */
+#define FIFO_EVENT_LOG_SIZE 8
+
+/* start of an episode in which one side had to wait for the other */
+typedef struct {
+    uint32_t timestamp;     /* ms since boot */
+    uint32_t fill;          /* bytes in the FIFO at the time */
+} fifo_event_t;
+
+typedef struct {
+    /* total episodes, the last FIFO_EVENT_LOG_SIZE of them are kept */
+    uint32_t cnt;
+    fifo_event_t events[FIFO_EVENT_LOG_SIZE];
+} fifo_event_log_t;
+
+/**
+ * Telemetry since the last fifo_reset(). Fill levels are sampled by the
+ * consumer each time it takes data. Values are copied without locking, so a
+ * snapshot taken while streaming may be slightly inconsistent.
+ */
+typedef struct {
+    uint32_t size;
+    uint32_t since;         /* ms since boot when collection started */
+    uint32_t fill_hist[FIFO_HIST_BUCKETS];
+    uint32_t min_fill;
+    uint32_t max_fill;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    long overrun_cnt;
+    long underrun_cnt;
+    /* reader found the FIFO empty */
+    fifo_event_log_t underruns;
+    /* writer found the FIFO full, normal flow control for network streams */
+    fifo_event_log_t overruns;
+} fifo_stats_t;
+
+typedef enum {
+    FIFO_OK = 0, FIFO_EOF = -1, FIFO_TIMEOUT = -2
+} fifo_wait_result_t;
+
+/**
+ * Single-producer / single-consumer byte FIFO.
+ * The details of this structure are intentionally hidden.
+ */
+typedef struct fifo fifo_t;
+
+/* set up the backing SPI RAM, returns 0 if the chip doesn't work */
+int fifo_init();
+
+/* FAKE_SPI_BUFF in playerconfig.h puts SPI RAM backed FIFOs into internal
+ * RAM at compile time, there is no fallback at run time */
+fifo_t *fifo_create(size_t size, fifo_backing_t backing);
+void fifo_destroy(fifo_t *fifo);
+
+/* blocking copy-in / copy-out */
+void fifo_read(fifo_t *fifo, char *buff, int len);
+void fifo_write(fifo_t *fifo, const char *buff, int len);
+
+/* zero-copy producer API */
+char *fifo_reserve(fifo_t *fifo, int len, int *avail);
+/* like fifo_reserve(), but returns NULL instead of waiting for room */
+char *fifo_try_reserve(fifo_t *fifo, int len, int *avail);
+void fifo_commit(fifo_t *fifo, int n);
+
+/* zero-copy consumer API */
+char *fifo_peek_contiguous(fifo_t *fifo, int *len);
+void fifo_consume(fifo_t *fifo, int n);
+
+/* Block until at least len bytes can be read. Wakes up as soon as the writer
+ * commits data, returns FIFO_EOF if the stream ended with fewer bytes left. */
+fifo_wait_result_t fifo_wait(fifo_t *fifo, int len, TickType_t timeout);
+
+/* set by the producer when the stream ends, cleared when a new one starts */
+void fifo_set_eof(fifo_t *fifo, bool eof);
+bool fifo_eof(fifo_t *fifo);
+
+/* Discard all data. Called by the consumer, or by any task while there is
+ * none. The writer may go on, it clears its own telemetry with its next
+ * write. */
+void fifo_reset(fifo_t *fifo);
+
+int fifo_fill(fifo_t *fifo);
+int fifo_free(fifo_t *fifo);
+int fifo_len(fifo_t *fifo);
+
+long fifo_overrun_count(fifo_t *fifo);
+long fifo_underrun_count(fifo_t *fifo);
+
+/* number of times the reader ran dry since the last fifo_reset(), a run of
+ * empty reads counts once */
+uint32_t fifo_underrun_episodes(fifo_t *fifo);
+
+/* copy the telemetry of this FIFO, cleared by fifo_reset() */
+void fifo_get_stats(fifo_t *fifo, fifo_stats_t *stats);
+
+/* log the telemetry to the console */
+void fifo_dump_stats(fifo_t *fifo, const char *name);
+
+#endif /* _INCLUDE_FIFO_H_ */
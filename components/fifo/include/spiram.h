@@ -1,6 +1,8 @@
 #ifndef _SPIRAM_H_
 #define _SPIRAM_H_
 
+#include <inttypes.h>
+
 #define SPIRAMSIZE (128*1024) //for a 23LC1024 chip
 
 
@@ -10,10 +12,28 @@
 //connected and the overall speed increase on the MP3 example is negligable.
 //#define SPIRAM_QIO
 
+//Define this to let the SPI controller move data by DMA. A single transaction
+//can then carry up to 4 KB instead of 64 bytes. Buffers DMA can't reach, in
+//flash or unaligned, are copied through an internal bounce buffer.
+//#define SPIRAM_DMA
+
+#define SPIRAM_CLOCK_HZ (20*1000*1000)
+
+//HSPI pins, SIO2/SIO3 are only used in QSPI mode
+#define SPIRAM_PIN_MOSI 13
+#define SPIRAM_PIN_MISO 12
+#define SPIRAM_PIN_SCLK 14
+#define SPIRAM_PIN_CS   15
+#define SPIRAM_PIN_SIO2 2
+#define SPIRAM_PIN_SIO3 4
+
 
 void spiRamInit();
+//Transfers of any length, split into as few bus transactions as possible
 void spiRamRead(int addr, char *buff, int len);
 void spiRamWrite(int addr, char *buff, int len);
 int spiRamTest();
+//Number of bus transactions since boot
+uint32_t spiRamTransactionCount();
 
-#endif
\ No newline at end of file
+#endif
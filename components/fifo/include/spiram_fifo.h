@@ -1,6 +1,8 @@
 #ifndef _SPIRAM_FIFO_H_
 #define _SPIRAM_FIFO_H_
 
+#include "fifo.h"
+
 int  spiRamFifoInit();
 void  spiRamFifoRead(char *buff, int len);
 void  spiRamFifoWrite(const char *buff, int len);
@@ -12,4 +14,7 @@ long  spiRamGetUnderrunCt();
 void spiRamFifoReset();
 int spiRamFifoLen();
 
+/* the instance behind the spiRamFifo* calls */
+fifo_t *spiRamFifoGet();
+
 #endif
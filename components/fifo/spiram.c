@@ -0,0 +1,266 @@
+/*
+ * spiram.c
+ *
+ * Driver for a 23LC1024 (or compatible) serial SRAM on the HSPI bus.
+ *
+ * Every spiRamRead/spiRamWrite call is turned into as few bus transactions
+ * as possible: with SPIRAM_DMA the whole request goes out in chunks of up to
+ * SPIRAM_MAX_TRANSFER bytes, without DMA the controller can only buffer 64
+ * bytes per transaction. The chip runs in sequential mode, so a transfer may
+ * cross page boundaries.
+ *
+ *  Created on: 22.06.2017
+ *      Author: michaelboeckling
+ */
+
+#include "playerconfig.h"
+
+#ifndef FAKE_SPI_BUFF
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "driver/spi_master.h"
+
+#ifdef SPIRAM_DMA
+#include "esp_heap_caps.h"
+#include "soc/soc_memory_layout.h"
+#endif
+
+#include "spiram.h"
+
+#define TAG "spiram"
+
+/* 23LC1024 instruction set */
+#define CMD_READ    0x03
+#define CMD_WRITE   0x02
+#define CMD_WRMR    0x01
+#define CMD_EQIO    0x38
+
+#define MODE_SEQUENTIAL 0x40
+
+#ifdef SPIRAM_DMA
+#define SPIRAM_DMA_CHAN 1
+#define SPIRAM_MAX_TRANSFER 4092
+#else
+#define SPIRAM_DMA_CHAN 0
+#define SPIRAM_MAX_TRANSFER 64
+#endif
+
+#ifdef SPIRAM_QIO
+#ifndef SPI_TRANS_MULTILINE_CMD
+#error "SPIRAM_QIO needs an IDF whose SPI master can send the command on 4 lines"
+#endif
+/* the chip wants one dummy byte before read data in SQI mode */
+#define QIO_READ_DUMMY_BITS 2
+#define QIO_FLAGS (SPI_TRANS_MODE_QIO | SPI_TRANS_MODE_DIOQIO_ADDR | SPI_TRANS_MULTILINE_CMD)
+#endif
+
+static spi_device_handle_t spi;
+
+/* the FIFO reader and writer live in different tasks */
+static SemaphoreHandle_t bus_lock;
+
+static uint32_t transaction_cnt = 0;
+
+#ifdef SPIRAM_DMA
+/* Takes the data of callers whose buffers DMA can't reach, like flash or
+ * unaligned pointers. Used under bus_lock. */
+static char *dma_bounce;
+
+static bool dma_reachable(const char *buf)
+{
+    return esp_ptr_dma_capable(buf) && ((uintptr_t) buf & 3) == 0;
+}
+#endif
+
+static void spi_transfer(uint8_t cmd, int addr, char *tx, char *rx, int len)
+{
+#ifdef SPIRAM_QIO
+    spi_transaction_ext_t ext = {
+        .base = {
+            .flags = QIO_FLAGS | SPI_TRANS_VARIABLE_DUMMY,
+            .cmd = cmd,
+            .addr = addr,
+            .length = (tx != NULL) ? len * 8 : 0,
+            .rxlength = (rx != NULL) ? len * 8 : 0,
+            .tx_buffer = tx,
+            .rx_buffer = rx
+        },
+        .dummy_bits = (rx != NULL) ? QIO_READ_DUMMY_BITS : 0
+    };
+    spi_transaction_t *t = &ext.base;
+#else
+    spi_transaction_t trans = {
+        .cmd = cmd,
+        .addr = addr,
+        .length = (tx != NULL) ? len * 8 : 0,
+        .rxlength = (rx != NULL) ? len * 8 : 0,
+        .tx_buffer = tx,
+        .rx_buffer = rx
+    };
+    spi_transaction_t *t = &trans;
+#endif
+
+    xSemaphoreTake(bus_lock, portMAX_DELAY);
+
+#ifdef SPIRAM_DMA
+    bool bounce_rx = rx != NULL && !dma_reachable(rx);
+    if (tx != NULL && !dma_reachable(tx)) {
+        memcpy(dma_bounce, tx, len);
+        t->tx_buffer = dma_bounce;
+    }
+    if (bounce_rx) {
+        t->rx_buffer = dma_bounce;
+    }
+#endif
+
+    esp_err_t err = spi_device_transmit(spi, t);
+    transaction_cnt++;
+
+#ifdef SPIRAM_DMA
+    if (bounce_rx) {
+        memcpy(rx, dma_bounce, len);
+    }
+#endif
+
+    xSemaphoreGive(bus_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "transfer of %d bytes at 0x%06x failed: %d", len, addr, err);
+    }
+}
+
+#ifdef SPIRAM_QIO
+/* single-line command without address, switches the chip to SQI */
+static esp_err_t spi_enter_qio()
+{
+    spi_transaction_ext_t ext = {
+        .base = {
+            .flags = SPI_TRANS_VARIABLE_ADDR,
+            .cmd = CMD_EQIO
+        },
+        .address_bits = 0
+    };
+
+    return spi_device_transmit(spi, &ext.base);
+}
+#endif
+
+void spiRamInit()
+{
+    spi_bus_config_t buscfg = {
+        .mosi_io_num = SPIRAM_PIN_MOSI,
+        .miso_io_num = SPIRAM_PIN_MISO,
+        .sclk_io_num = SPIRAM_PIN_SCLK,
+#ifdef SPIRAM_QIO
+        .quadwp_io_num = SPIRAM_PIN_SIO2,
+        .quadhd_io_num = SPIRAM_PIN_SIO3,
+#else
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+#endif
+        .max_transfer_sz = SPIRAM_MAX_TRANSFER
+    };
+
+    spi_device_interface_config_t devcfg = {
+        .command_bits = 8,
+        .address_bits = 24,
+        .mode = 0,
+        .clock_speed_hz = SPIRAM_CLOCK_HZ,
+        .spics_io_num = SPIRAM_PIN_CS,
+        .flags = SPI_DEVICE_HALFDUPLEX,
+        .queue_size = 1
+    };
+
+    bus_lock = xSemaphoreCreateMutex();
+
+#ifdef SPIRAM_DMA
+    dma_bounce = heap_caps_malloc(SPIRAM_MAX_TRANSFER, MALLOC_CAP_DMA);
+    if (dma_bounce == NULL) {
+        ESP_LOGE(TAG, "couldn't allocate DMA bounce buffer");
+        abort();
+    }
+#endif
+
+    ESP_ERROR_CHECK(spi_bus_initialize(HSPI_HOST, &buscfg, SPIRAM_DMA_CHAN));
+    ESP_ERROR_CHECK(spi_bus_add_device(HSPI_HOST, &devcfg, &spi));
+
+    // sequential is the power-on default, set it anyway. The mode byte goes
+    // out as the top address byte, the chip ignores the clocks after it.
+    spi_transaction_t wrmr = {
+        .cmd = CMD_WRMR,
+        .addr = MODE_SEQUENTIAL << 16
+    };
+    ESP_ERROR_CHECK(spi_device_transmit(spi, &wrmr));
+
+#ifdef SPIRAM_QIO
+    // from here on the chip expects everything on 4 lines
+    ESP_ERROR_CHECK(spi_enter_qio());
+#endif
+
+    ESP_LOGI(TAG, "initialized, %d kHz, %d bytes per transaction",
+            SPIRAM_CLOCK_HZ / 1000, SPIRAM_MAX_TRANSFER);
+}
+
+void spiRamRead(int addr, char *buff, int len)
+{
+    while (len > 0) {
+        int n = (len < SPIRAM_MAX_TRANSFER) ? len : SPIRAM_MAX_TRANSFER;
+        spi_transfer(CMD_READ, addr, NULL, buff, n);
+        addr += n;
+        buff += n;
+        len -= n;
+    }
+}
+
+void spiRamWrite(int addr, char *buff, int len)
+{
+    while (len > 0) {
+        int n = (len < SPIRAM_MAX_TRANSFER) ? len : SPIRAM_MAX_TRANSFER;
+        spi_transfer(CMD_WRITE, addr, buff, NULL, n);
+        addr += n;
+        buff += n;
+        len -= n;
+    }
+}
+
+uint32_t spiRamTransactionCount()
+{
+    return transaction_cnt;
+}
+
+/* Write a pattern across a few transaction boundaries and check it sticks. */
+int spiRamTest()
+{
+    const int len = 3 * SPIRAM_MAX_TRANSFER + 13;
+    char *a = malloc(len);
+    char *b = malloc(len);
+    int ok = (a != NULL && b != NULL);
+
+    for (int addr = 0; ok && addr < SPIRAMSIZE; addr += SPIRAMSIZE / 4) {
+        for (int i = 0; i < len; i++) {
+            a[i] = (char) (i ^ (addr >> 8));
+        }
+        memset(b, 0, len);
+
+        spiRamWrite(addr, a, len);
+        spiRamRead(addr, b, len);
+
+        if (memcmp(a, b, len) != 0) {
+            ESP_LOGE(TAG, "mismatch at 0x%06x", addr);
+            ok = 0;
+        }
+    }
+
+    free(a);
+    free(b);
+    return ok;
+}
+
+#endif
@@ -8,6 +8,9 @@
 #ifndef _INCLUDE_LIBFAAD_DECODER_H_
 #define _INCLUDE_LIBFAAD_DECODER_H_
 
-void libfaac_decoder_task(void *pvParameters);
+#include "codec.h"
+
+/* AAC in an MP4 container, libfaad */
+extern const codec_t codec_mp4;
 
 #endif /* _INCLUDE_LIBFAAD_DECODER_H_ */
@@ -27,10 +27,12 @@
 #include "m4a.h"
 #include "audio_renderer.h"
 #include "audio_player.h"
-#include "spiram_fifo.h"
+#include "codec.h"
+#include "fifo.h"
 
-#define CODEC_ERROR -1
 #define FAAD_BYTE_BUFFER_SIZE (2048-12)
+/* a decode call may look at this many bytes in one piece */
+#define FAAD_GUARD_SIZE (FAAD_MIN_STREAMSIZE * 2)
 #define TAG "libfaad_dec"
 
 //Skip ID3-Tags at the beginning of the file.
@@ -83,54 +85,64 @@ void print_frame_info(NeAACDecFrameInfo *frame_info)
 }
 
 
-void libfaac_decoder_task(void *pvParameters)
+/* state of one renderer source, the dialog and the content worker decode
+ * at the same time */
+typedef struct {
+    /* ring buffer, allocated with the first stream and reused by all others */
+    buffer_t *buf;
+
+    /* state of the current stream */
+    NeAACDecHandle decoder;
+    pcm_format_t pcm_fmt;
+} libfaad_state_t;
+
+static libfaad_state_t states[RENDERER_SOURCE_COUNT];
+
+/* an MP4 file starts with its ftyp box */
+static int libfaad_probe(const uint8_t *data, size_t len)
 {
+    if (len >= 8 && memcmp(data + 4, "ftyp", 4) == 0)
+        return 0;
+
+    return -1;
+}
 
-    player_t *player = pvParameters;
+static int libfaad_open(player_t *player)
+{
     /* Note that when dealing with QuickTime/MPEG4 files, terminology is
      * a bit confusing. Files with sound are split up in chunks, where
      * each chunk contains one or more samples. Each sample in turn
      * contains a number of "sound samples" (the kind you refer to with
      * the sampling frequency).
      */
-    size_t n;
     demux_res_t demux_res;
     stream_t input_stream;
-    uint32_t sound_samples_done;
-    uint32_t elapsed_time;
-    int file_offset;
-    int framelength;
-    int lead_trim = 0;
-    unsigned int frame_samples;
-    unsigned int i;
-    unsigned char* buffer;
-    NeAACDecFrameInfo frame_info;
-    NeAACDecHandle decoder;
     int err;
-    uint32_t seek_idx = 0;
     unsigned long samp_rate = 0;
     uint32_t sbr_fac = 1;
     unsigned char chan = 0;
-    void *ret;
-    // enum codec_command_action action;
-    intptr_t param;
-    bool empty_first_frame = false;
+    libfaad_state_t *st = &states[player->source];
 
+    st->decoder = NULL;
 
-    buffer_t buf = {
-        .len=FAAD_BYTE_BUFFER_SIZE
-    };
-    buf.base = calloc(FAAD_BYTE_BUFFER_SIZE, sizeof(uint8_t));
-    buf.read_pos = buf.base;
-    buf.write_pos = buf.base;
+    /* ring buffer, decoding advances through it without moving data */
+    if(st->buf == NULL) {
+        st->buf = buf_create_ring(FAAD_BYTE_BUFFER_SIZE, FAAD_GUARD_SIZE);
+    }
+    if(st->buf == NULL) {
+        ESP_LOGE(TAG, "FAAD: couldn't allocate input buffer");
+        return -1;
+    }
+    buf_reset(st->buf);
+    st->buf->fifo = player->fifo;
 
     /* Clean and initialize decoder structures */
     memset(&demux_res, 0, sizeof(demux_res));
 
-    stream_create(&input_stream, &buf);
-    fill_read_buffer(&buf);
+    stream_create(&input_stream, st->buf);
+    fill_read_buffer(st->buf);
 
-    //for(uint8_t *i = buf.read_pos; i < buf.write_pos; i++)
+    //for(uint8_t *i = buf->read_pos; i < buf->write_pos; i++)
     //    printf("%X", (*i));
 
     content_type_t content_type =  player->media_stream->content_type;
@@ -141,55 +153,53 @@ void libfaac_decoder_task(void *pvParameters)
          * the movie data, which can be used directly by the decoder */
          if (!qtmovie_read(&input_stream, &demux_res)) {
              ESP_LOGE(TAG, "FAAD: File init error\n");
-             // return CODEC_ERROR;
-             return;
+             return -1;
          } else {
              ESP_LOGI(TAG, "qtmovie_read success");
          }
     } else if(content_type == AUDIO_AAC || content_type == OCTET_STREAM) {
-        memcpy(demux_res.codecdata, buf.read_pos, 64);
+        memcpy(demux_res.codecdata, st->buf->read_pos, 64);
         demux_res.codecdata_len = 64;
     } else {
         ESP_LOGE(TAG, "unsupported content-type: %d", content_type);
-        return;
+        return -1;
     }
 
     /* initialise the sound converter */
-    decoder = NeAACDecOpen();
-    if (!decoder) {
+    st->decoder = NeAACDecOpen();
+    if (!st->decoder) {
         ESP_LOGE(TAG, "FAAD: Decode open error");
-        return ;
+        return -1;
     }
 
-    NeAACDecConfigurationPtr conf = NeAACDecGetCurrentConfiguration(decoder);
-    renderer_config_t *renderer = renderer_get();
-    switch(renderer->bit_depth) {
-        case I2S_BITS_PER_SAMPLE_8BIT:
-        case I2S_BITS_PER_SAMPLE_16BIT:
-            conf->outputFormat = FAAD_FMT_16BIT;
-            break;
-        case I2S_BITS_PER_SAMPLE_24BIT:
-            conf->outputFormat = FAAD_FMT_24BIT;
-            break;
+    // decode to the depth the renderer queues, it converts nothing then
+    renderer_get_format(&st->pcm_fmt);
+
+    NeAACDecConfigurationPtr conf = NeAACDecGetCurrentConfiguration(st->decoder);
+    switch(st->pcm_fmt.bit_depth) {
         case I2S_BITS_PER_SAMPLE_32BIT:
             conf->outputFormat = FAAD_FMT_32BIT;
             break;
+        default:
+            conf->outputFormat = FAAD_FMT_16BIT;
+            st->pcm_fmt.bit_depth = I2S_BITS_PER_SAMPLE_16BIT;
+            break;
     }
     conf->defObjectType = LC;
     conf->defSampleRate = 44100;
-    NeAACDecSetConfiguration(decoder, conf);
+    NeAACDecSetConfiguration(st->decoder, conf);
 
 
     if(content_type == AUDIO_MP4) {
-        err = NeAACDecInit2(decoder, demux_res.codecdata, demux_res.codecdata_len, &samp_rate, &chan);
+        err = NeAACDecInit2(st->decoder, demux_res.codecdata, demux_res.codecdata_len, &samp_rate, &chan);
     } else {
-        err = NeAACDecInit(decoder, demux_res.codecdata, demux_res.codecdata_len, &samp_rate, &chan);
+        err = NeAACDecInit(st->decoder, demux_res.codecdata, demux_res.codecdata_len, &samp_rate, &chan);
     }
 
     if (err) {
         //LOGF("FAAD: DecInit: %d, %d\n", err, decoder->object_type);
         ESP_LOGE(TAG, "FAAD: DecInit: %d", err);
-        return ;
+        return -1;
     }
 
 #ifdef SBR_DEC
@@ -203,46 +213,67 @@ void libfaac_decoder_task(void *pvParameters)
      */
 #endif
 
-    pcm_format_t pcm_fmt = {
-        .sample_rate = samp_rate,
-        .bit_depth = I2S_BITS_PER_SAMPLE_16BIT,
-        .num_channels = chan,
-        .buffer_format = PCM_INTERLEAVED
-    };
+    st->pcm_fmt.sample_rate = samp_rate;
+    st->pcm_fmt.num_channels = chan;
 
     ESP_LOGI(TAG, "RAM left %d", esp_get_free_heap_size());
 
-    while (!player->media_stream->eof) {
+    return 0;
+}
+
+static int libfaad_decode_frame(player_t *player)
+{
+    libfaad_state_t *st = &states[player->source];
+    NeAACDecFrameInfo frame_info;
+    void *ret;
 
-        /* Request the required number of bytes from the input buffer */
-        fill_read_buffer(&buf);
+    /* Request the required number of bytes from the input buffer */
+    fill_read_buffer(st->buf);
 
-        /* Decode one block - returned samples will be host-endian */
-        ret = NeAACDecDecode(decoder, &frame_info, buf.read_pos,
-                buf.write_pos - buf.read_pos);
+    // play what is buffered when the download is complete
+    if (buf_data_unread(st->buf) == 0 && player->media_stream->eof)
+        return CODEC_EOF;
 
-        /* NeAACDecDecode may sometimes return NULL without setting error. */
-        if (ret == NULL || frame_info.error > 0) {
-            printf("FAAD: decode error '%s'\n",
-                    NeAACDecGetErrorMessage(frame_info.error));
-            return;
-        }
+    /* Decode one block - returned samples will be host-endian */
+    ret = NeAACDecDecode(st->decoder, &frame_info, st->buf->read_pos,
+            buf_data_contiguous(st->buf));
 
-        /* Advance codec buffer (no need to call set_offset because of this) */
-        buf_seek_rel(&buf, frame_info.bytesconsumed);
+    /* NeAACDecDecode may sometimes return NULL without setting error. */
+    if (ret == NULL || frame_info.error > 0) {
+        printf("FAAD: decode error '%s'\n",
+                NeAACDecGetErrorMessage(frame_info.error));
+        return CODEC_ERROR;
+    }
 
-        /* Output the audio */
-        frame_samples = frame_info.samples >> 1;
-        framelength = frame_samples - lead_trim;
+    /* Advance codec buffer (no need to call set_offset because of this) */
+    buf_seek_rel(st->buf, frame_info.bytesconsumed);
 
-        char *pcm_buf = ret;
-        render_samples(pcm_buf, frame_info.samples * 2, &pcm_fmt);
+    /* Output the audio */
+    char *pcm_buf = ret;
+    render_source_samples(player->source, pcm_buf,
+            frame_info.samples * (st->pcm_fmt.bit_depth / 8), &st->pcm_fmt);
 
-        // ESP_LOGI(TAG, "stack: %d\n", uxTaskGetStackHighWaterMark(NULL));
-    }
+    // ESP_LOGI(TAG, "stack: %d\n", uxTaskGetStackHighWaterMark(NULL));
+    return CODEC_OK;
+}
 
-    NeAACDecClose(decoder);
+static void libfaad_close(player_t *player)
+{
+    libfaad_state_t *st = &states[player->source];
 
-    vTaskDelete(NULL);
+    if (st->decoder != NULL) {
+        NeAACDecClose(st->decoder);
+        st->decoder = NULL;
+    }
 }
 
+const codec_t codec_mp4 = {
+    .name = "mp4",
+    .content_type = AUDIO_MP4,
+    // mostly libfaad's own
+    .stack_size = 55000,
+    .probe = libfaad_probe,
+    .open = libfaad_open,
+    .decode_frame = libfaad_decode_frame,
+    .close = libfaad_close
+};
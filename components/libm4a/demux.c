@@ -281,11 +281,11 @@ static bool read_chunk_stsd(qtmovie_t *qtmovie, size_t chunk_len)
               return false;
           }
 
-          j = qtmovie->stream->buf->read_pos + sub_chunk_len - 8;
+          j = stream_tell(qtmovie->stream) + sub_chunk_len - 8;
           if (read_chunk_esds(qtmovie,sub_chunk_len)) {
-             if (j != qtmovie->stream->buf->read_pos) {
-               DEBUGF("curpos=%d, sub_chunk_len=%d, j=%d - Skipping %d bytes\n", (int)qtmovie->stream->buf->read_pos, sub_chunk_len, j, j - (int) qtmovie->stream->buf->read_pos);
-               stream_skip(qtmovie->stream, j - (int) qtmovie->stream->buf->read_pos);
+             if (j != stream_tell(qtmovie->stream)) {
+               DEBUGF("curpos=%d, sub_chunk_len=%d, j=%d - Skipping %d bytes\n", stream_tell(qtmovie->stream), sub_chunk_len, j, j - stream_tell(qtmovie->stream));
+               stream_skip(qtmovie->stream, j - stream_tell(qtmovie->stream));
                // TODO hotfix
                // stream_skip(qtmovie->stream, 4);
              }
@@ -794,12 +794,20 @@ int qtmovie_read(stream_t *file, demux_res_t *demux_res)
         fourcc_t chunk_id;
 
         chunk_len = stream_read_uint32(qtmovie.stream);
+        if (stream_timeout(qtmovie.stream))
+        {
+            DEBUGF("stream timed out\n");
+            return 0;
+        }
         if (stream_eof(qtmovie.stream))
         {
             DEBUGF("stream_eof reached\n");
             if(qtmovie.res->mdat_offset == 0 || qtmovie.res->format == 0)
                 return 0;
-            stream_seek(qtmovie.stream, qtmovie.res->mdat_offset);
+            if(stream_seek(qtmovie.stream, qtmovie.res->mdat_offset) != 0) {
+                DEBUGF("can't seek back to mdat at %u\n", qtmovie.res->mdat_offset);
+                return 0;
+            }
             return 1;
         }
 
@@ -833,8 +841,10 @@ int qtmovie_read(stream_t *file, demux_res_t *demux_res)
                This avoids having to seek, which might cause rebuffering. */
             if(qtmovie.res->format > 0)
                 return 1;
-            stream_skip(qtmovie.stream, chunk_len - 8);
-            break;
+            /* The stream can't go back to the audio once the moov behind
+               it has been read, don't download the file for nothing. */
+            DEBUGF("mdat before moov, file isn't streamable\n");
+            return 0;
 
             /*  these following atoms can be skipped !!!! */
         case MAKEFOURCC('f','r','e','e'):
@@ -43,6 +43,8 @@ typedef struct {
   // struct codec_api* ci;
   buffer_t *buf;
   int eof;
+  /* data stopped arriving, distinct from the stream having ended */
+  int timeout;
 } stream_t;
 
 typedef uint32_t fourcc_t;
@@ -124,9 +126,10 @@ uint16_t stream_read_uint16(stream_t *stream);
 uint8_t stream_read_uint8(stream_t *stream);
 
 void stream_skip(stream_t *stream, size_t skip);
-void stream_seek(stream_t *stream, size_t offset);
+int stream_seek(stream_t *stream, size_t offset);
 
 int stream_eof(stream_t *stream);
+int stream_timeout(stream_t *stream);
 
 // void stream_create(stream_t *stream,struct codec_api* ci);
 void stream_create(stream_t *stream,buffer_t *buf);
@@ -22,6 +22,7 @@
 // #include <codecs.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <string.h>
 #include "m4a.h"
 
 /* Implementation of the stream.h functions used by libalac */
@@ -36,10 +37,23 @@
                    v = (((v) & 0x00FF) << 0x08) | \
                        (((v) & 0xFF00) >> 0x08); } while (0)
 
+static void stream_set_error(stream_t *stream, int err)
+{
+    if (err == BUF_ERR_EOF)
+        stream->eof = 1;
+    else if (err == BUF_ERR_TIMEOUT)
+        stream->timeout = 1;
+}
+
 /* A normal read without any byte-swapping */
 void stream_read(stream_t *stream, size_t size, void *buf)
 {
-    buf_read(buf, size, 1, stream->buf);
+    int err = buf_read_wait(buf, size, stream->buf, BUF_READ_TIMEOUT_MS);
+    if (err < 0) {
+        // callers don't check, hand them zeroes rather than stack garbage
+        memset(buf, 0, size);
+        stream_set_error(stream, err);
+    }
 }
 
 int32_t stream_read_int32(stream_t *stream)
@@ -54,7 +68,8 @@ int32_t stream_read_int32(stream_t *stream)
 
 int32_t stream_tell(stream_t *stream)
 {
-    return stream->buf->read_pos;
+    // stream offset, buffer pointers move when the buffer is refilled
+    return stream->buf->bytes_consumed;
     // return stream->ci->curpos;
 }
 
@@ -88,19 +103,32 @@ uint8_t stream_read_uint8(stream_t *stream)
 void stream_skip(stream_t *stream, size_t skip)
 {
     // stream->ci->advance_buffer(skip);
-    buf_seek_rel(stream->buf, skip);
+    stream_set_error(stream, buf_seek_rel(stream->buf, skip));
 }
 
-void stream_seek(stream_t *stream, size_t offset)
+/* The stream comes off the network, so this only goes forward: it skips to
+ * offset, which must not have been read past yet. 0 on success. */
+int stream_seek(stream_t *stream, size_t offset)
 {
-    buf_seek_abs(stream->buf, offset);
+    uint32_t pos = stream->buf->bytes_consumed;
+    if (offset < pos)
+        return -1;
+
     // stream->ci->seek_buffer(offset);
+    int err = buf_seek_rel(stream->buf, offset - pos);
+    stream_set_error(stream, err);
+    return err;
 }
 
 int stream_eof(stream_t *stream)
 {
     return stream->eof;
 }
+
+int stream_timeout(stream_t *stream)
+{
+    return stream->timeout;
+}
 /*
 void stream_create(stream_t *stream,struct codec_api* ci)
 {
@@ -113,6 +141,7 @@ void stream_create(stream_t *stream,buffer_t *buf)
 {
     stream->buf = buf;
     stream->eof=0;
+    stream->timeout=0;
 }
 
 /* Check if there is a dedicated byte position contained for the given frame.
@@ -201,7 +230,7 @@ unsigned int m4a_seek(demux_res_t* demux_res, stream_t* stream,
 
     /* We know the new file position, so let's try to seek to it */
     // if (stream->ci->seek_buffer(new_pos))
-    if (buf_seek_abs(stream->buf, new_pos))
+    if (stream_seek(stream, new_pos) == 0)
     {
         *sound_samples_done = new_sound_sample;
         *current_sample = new_sample;
@@ -268,7 +297,7 @@ unsigned int m4a_seek_raw(demux_res_t* demux_res, stream_t* stream,
 
     /* Go to the new file position. */
     // if (stream->ci->seek_buffer(new_pos))
-    if (buf_seek_abs(stream->buf, new_pos))
+    if (stream_seek(stream, new_pos) == 0)
     {
         *sound_samples_done = new_sound_sample;
         *current_sample = chunk_sample;
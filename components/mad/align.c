@@ -1,10 +1,11 @@
 
 // #include "esp_common.h"
+#include <stdint.h>
 
 char unalChar(const char *adr) {
-	int *p=(int *)((int)adr&0xfffffffc);
+	int *p=(int *)((uintptr_t)adr&~(uintptr_t)3);
 	int v=*p;
-	int w=((int)adr&3);
+	int w=((uintptr_t)adr&3);
 	if (w==0) return ((v>>0)&0xff);
 	if (w==1) return ((v>>8)&0xff);
 	if (w==2) return ((v>>16)&0xff);
@@ -13,8 +14,8 @@ char unalChar(const char *adr) {
 
 
 short unalShort(const short *adr) {
-	int *p=(int *)((int)adr&0xfffffffc);
+	int *p=(int *)((uintptr_t)adr&~(uintptr_t)3);
 	int v=*p;
-	int w=((int)adr&3);
+	int w=((uintptr_t)adr&3);
 	if (w==0) return (v&0xffff); else return (v>>16);
 }
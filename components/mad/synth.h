@@ -66,8 +66,9 @@ void mad_synth_mute(struct mad_synth *);
 void mad_synth_frame(struct mad_synth *, struct mad_frame const *);
 
 void render_sample_block_mono(short *short_sample_buff, int no_samples);
-void render_sample_block(short *sample_buff_ch0, short *sample_buff_ch1, int num_samples, unsigned int num_channels);
-void set_dac_sample_rate(int rate);
+/* output callbacks, the synth tells them apart by the synth they come from */
+void render_sample_block(struct mad_synth *synth, mad_fixed_t *sample_buff_ch0, mad_fixed_t *sample_buff_ch1, int num_samples, unsigned int num_channels);
+void set_dac_sample_rate(struct mad_synth *synth, int rate);
 
 
 # endif
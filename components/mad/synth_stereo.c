@@ -37,32 +37,11 @@
 // short int saved_samples[SAVED_SAMPLE_BUFF_LEN];
 
 /*
- * The following utility routine performs simple rounding, clipping, and
- * scaling of MAD's high-resolution samples down to 16 bits. It does not
- * perform any dithering or noise shaping, which would be recommended to
- * obtain any exceptional audio quality. It is therefore not recommended to
- * use this routine if high-quality output is desired.
+ * The synth hands out MAD's high-resolution samples as they are, rounding,
+ * clipping and scaling down to the output depth is left to
+ * render_sample_block().
  */
 
-static inline
-signed int scale(mad_fixed_t sample)
-{
-  /* round */
-  sample += (1L << (MAD_F_FRACBITS - 16));
-
-  /* clip */
-  if (sample >= MAD_F_ONE)
-    sample = MAD_F_ONE - 1;
-  else if (sample < -MAD_F_ONE)
-    sample = -MAD_F_ONE;
-
-  /* quantize */
-  //The original nxp code had
-  //return sample >> (MAD_F_FRACBITS + 1 - 16);
-  //but somehow that clipped and distorted on loud sounds...
-  //This seems to be OK:
-  return sample >> (MAD_F_FRACBITS + 2 - 16);
-}
 /*
  * NAME:	synth->init()
  * DESCRIPTION:	initialize synth struct
@@ -593,7 +572,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
 		unsigned int nch, unsigned int ns)
 {
   unsigned int phase, ch, s, sb, pe, po;
-  short int *pcm1, *pcm2;
+  mad_fixed_t *pcm1, *pcm2;
   mad_fixed_t (*filter)[2][2][16][8];
   mad_fixed_t (*sbsample)[36][32];
   register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -601,7 +580,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
   register mad_fixed64hi_t hi;
   register mad_fixed64lo_t lo;
   mad_fixed_t raw_sample;
-  short int short_sample_buff[2][32];
+  mad_fixed_t sample_buff[2][32];
 
   phase = synth->phase;
 
@@ -610,14 +589,11 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
 
   for (s = 0; s < ns; ++s)
   {
-    memset (short_sample_buff[0], 0x00, sizeof(short_sample_buff[0]));
-    memset (short_sample_buff[1], 0x00, sizeof(short_sample_buff[0]));
-
     for (ch = 0; ch < nch; ++ch)
     {
       sbsample = (void*) &frame->sbsample[ch];
       filter   = &synth->filter[ch];
-      pcm1     = short_sample_buff[ch];
+      pcm1     = sample_buff[ch];
 
       dct32((*sbsample)[s], phase >> 1,
 	    (*filter)[0][phase & 1], (*filter)[1][phase & 1]);
@@ -655,8 +631,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
       MLA(hi, lo, (*fe)[7], ptr[ 2]);
 
       raw_sample = SHIFT(MLZ(hi, lo));
-      raw_sample = scale(raw_sample);
-      (*pcm1++) += (short int)raw_sample;
+      (*pcm1++) = raw_sample;
       pcm2 = pcm1 + 30;
 
       for (sb = 1; sb < 16; ++sb)
@@ -689,8 +664,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
         MLA(hi, lo, (*fe)[0], ptr[ 0]);
 
         raw_sample = SHIFT(MLZ(hi, lo));
-        raw_sample = scale(raw_sample);
-        (*pcm1++) += (short int)raw_sample;
+        (*pcm1++) = raw_sample;
 
         ptr = *Dptr - pe;
         ML0(hi, lo, (*fe)[0], ptr[31 - 16]);
@@ -713,8 +687,7 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
         MLA(hi, lo, (*fo)[0], ptr[31 - 16]);
 
         raw_sample = SHIFT(MLZ(hi, lo));
-        raw_sample = scale(raw_sample);
-        (*pcm2--) += (short int)raw_sample;
+        (*pcm2--) = raw_sample;
 
         ++fo;
       }
@@ -732,13 +705,12 @@ void synth_full(struct mad_synth *synth, struct mad_frame const *frame,
       MLA(hi, lo, (*fo)[7], ptr[ 2]);
 
       raw_sample = SHIFT(-MLZ(hi, lo));
-      raw_sample = scale(raw_sample);
-      (*pcm1) += (short int)raw_sample;
+      (*pcm1) = raw_sample;
 
     }  /* Channel For */
 
     /* Render block */
-    render_sample_block(short_sample_buff[0], short_sample_buff[1], 32, nch);
+    render_sample_block(synth, sample_buff[0], sample_buff[1], 32, nch);
 
     phase = (phase + 1) % 16;
 
@@ -755,7 +727,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
 		unsigned int nch, unsigned int ns)
 {
   unsigned int phase, ch, s, sb, pe, po;
-  short int *pcm1, *pcm2;
+  mad_fixed_t *pcm1, *pcm2;
   mad_fixed_t (*filter)[2][2][16][8];
   mad_fixed_t (*sbsample)[36][32];
   register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -763,7 +735,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
   register mad_fixed64hi_t hi;
   register mad_fixed64lo_t lo;
   mad_fixed_t raw_sample;
-  short int short_sample_buff[2][16];
+  mad_fixed_t sample_buff[2][16];
 
   phase = synth->phase;
 
@@ -772,14 +744,11 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
 
   for (s = 0; s < ns; ++s)
   {
-    memset (short_sample_buff[0], 0x00, sizeof(short_sample_buff[0]));
-    memset (short_sample_buff[1], 0x00, sizeof(short_sample_buff[0]));
-
     for (ch = 0; ch < nch; ++ch)
     {
       sbsample = (void *) &frame->sbsample[ch];
       filter   = &synth->filter[ch];
-      pcm1 = short_sample_buff[ch];
+      pcm1 = sample_buff[ch];
 
       dct32((*sbsample)[s], phase >> 1,
 	    (*filter)[0][phase & 1], (*filter)[1][phase & 1]);
@@ -817,8 +786,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
       MLA(hi, lo, (*fe)[7], ptr[ 2]);
 
       raw_sample = SHIFT(MLZ(hi, lo));
-      raw_sample = scale(raw_sample);
-      (*pcm1++) += (short int)raw_sample;
+      (*pcm1++) = raw_sample;
       pcm2 = pcm1 + 14;
 
       for (sb = 1; sb < 16; ++sb)
@@ -851,8 +819,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
         MLA(hi, lo, (*fe)[0], ptr[ 0]);
 
         raw_sample = SHIFT(MLZ(hi, lo));
-        raw_sample = scale(raw_sample);
-        (*pcm1++) += (short int)raw_sample;
+        (*pcm1++) = raw_sample;
 
         ptr = *Dptr - pe;
         ML0(hi, lo, (*fe)[0], ptr[31 - 16]);
@@ -875,8 +842,7 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
         MLA(hi, lo, (*fo)[0], ptr[31 - 16]);
 
         raw_sample = SHIFT(MLZ(hi, lo));
-        raw_sample = scale(raw_sample);
-        (*pcm2--) += (short int)raw_sample;
+        (*pcm2--) = raw_sample;
 
         ++fo;
       }
@@ -894,13 +860,12 @@ void synth_half(struct mad_synth *synth, struct mad_frame const *frame,
       MLA(hi, lo, (*fo)[7], ptr[ 2]);
 
       raw_sample = SHIFT(-MLZ(hi, lo));
-      raw_sample = scale(raw_sample);
-      (*pcm1) += (short int)raw_sample;
+      (*pcm1) = raw_sample;
 
     } /* Channel For */
 
     /* Block render */
-    render_sample_block(short_sample_buff[0], short_sample_buff[1], 16, nch);
+    render_sample_block(synth, sample_buff[0], sample_buff[1], 16, nch);
 
     phase = (phase + 1) % 16;
 
@@ -921,7 +886,7 @@ void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
   ns  = MAD_NSBSAMPLES(&frame->header);
 
   synth->pcm.samplerate = frame->header.samplerate;
-  set_dac_sample_rate(synth->pcm.samplerate);
+  set_dac_sample_rate(synth, synth->pcm.samplerate);
   synth->pcm.channels   = nch;
   synth->pcm.length     = 32 * ns;
 
@@ -930,7 +895,7 @@ void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
   if (frame->options & MAD_OPTION_HALFSAMPLERATE) {
     synth->pcm.samplerate /= 2;
     synth->pcm.length     /= 2;
-    set_dac_sample_rate(synth->pcm.samplerate);
+    set_dac_sample_rate(synth, synth->pcm.samplerate);
     synth_frame = synth_half;
   }
 
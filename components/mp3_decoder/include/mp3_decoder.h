@@ -5,4 +5,12 @@
  *      Author: michaelboeckling
  */
 
-void mp3_decoder_task(void *pvParameters);
+#ifndef _INCLUDE_MP3_DECODER_H_
+#define _INCLUDE_MP3_DECODER_H_
+
+#include "codec.h"
+
+/* MPEG audio layer I-III, libmad */
+extern const codec_t codec_mp3;
+
+#endif /* _INCLUDE_MP3_DECODER_H_ */
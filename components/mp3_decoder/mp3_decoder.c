@@ -20,12 +20,14 @@
 
 #include "driver/i2s.h"
 #include "audio_renderer.h"
+#include "pcm_convert.h"
 #include "audio_player.h"
-#include "spiram_fifo.h"
+#include "bitrate.h"
+#include "codec.h"
+#include "fifo.h"
 #include "mp3_decoder.h"
 #include "common_buffer.h"
 #include "driver/gpio.h"
-#include "ui.h"
 
 #define TAG "mad_decoder"
 
@@ -33,26 +35,66 @@
 // MPEG 2.5 Layer II, 8000 Hz @ 160 kbps, with a padding slot plus 8 byte MAD_BUFFER_GUARD.
 #define MAX_FRAME_SIZE (2889)
 
-// The theoretical minimum frame size of 24 plus 8 byte MAD_BUFFER_GUARD.
-#define MIN_FRAME_SIZE (32)
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
 
-static long buf_underrun_cnt;
+#if FIFO_MIRROR_SIZE < MAX_FRAME_SIZE
+#error "FIFO mirror region can't hold a whole MPEG frame"
+#endif
 
-/* default MAD buffer format */
-pcm_format_t mad_buffer_fmt = {
-    .sample_rate = 44100,
-    .bit_depth = I2S_BITS_PER_SAMPLE_16BIT,
-    .num_channels = 2,
-    .buffer_format = PCM_LEFT_RIGHT
-};
+/* Decoder state of one renderer source. The dialog and the content worker
+ * decode at the same time, each on its own. */
+typedef struct {
+    /* first, the synth callbacks find their state by it */
+    struct mad_synth synth;
+    struct mad_stream *stream;
+    struct mad_frame *frame;
+
+    renderer_source_t source;
+    /* MAD buffer format, the renderer's native depth once decoding */
+    pcm_format_t fmt;
+
+    /* Synth blocks of 32 frames gathered into one renderer block, interleaved,
+     * 16 or 32 bit samples. The renderer is woken once per block. */
+    int32_t sample_block[PCM_BLOCK_FRAMES * 2];
+    uint32_t sample_block_frames;
 
-static enum mad_flow input(struct mad_stream *stream, buffer_t *buf, player_t *player)
+    long buf_underrun_cnt;
+} mp3_state_t;
+
+/* allocated with the first stream of a source and kept for all others */
+static mp3_state_t *states[RENDERER_SOURCE_COUNT];
+
+static inline mp3_state_t *state_of(struct mad_synth *synth)
 {
-    int bytes_to_read;
+    return (mp3_state_t *) synth;
+}
+
+static void flush_sample_block(mp3_state_t *st)
+{
+    if (st->sample_block_frames == 0)
+        return;
+
+    uint32_t sample_bytes = st->fmt.bit_depth / 8;
+    render_source_samples(st->source, (char *) st->sample_block,
+            st->sample_block_frames * 2 * sample_bytes, &st->fmt);
+    st->sample_block_frames = 0;
+}
+
+/* Hands libmad a pointer straight into the FIFO, no intermediate copy. */
+static enum mad_flow input(mp3_state_t *st, player_t *player)
+{
+    struct mad_stream *stream = st->stream;
+    int bytes_avail;
+    char *frame_data;
 
     // next_frame is the position MAD is interested in resuming from
-    uint32_t bytes_consumed  = stream->next_frame - stream->buffer;
-    buf_seek_rel(buf, bytes_consumed);
+    size_t bytes_seen = 0;
+    if (stream->buffer != NULL) {
+        fifo_consume(player->fifo, stream->next_frame - stream->buffer);
+        bytes_seen = stream->bufend - stream->next_frame;
+    }
 
     while (1) {
 
@@ -61,37 +103,29 @@ static enum mad_flow input(struct mad_stream *stream, buffer_t *buf, player_t *p
             return MAD_FLOW_STOP;
         }
 
-        // Calculate amount of bytes we need to fill buffer.
-        bytes_to_read = min(buf_free_capacity_after_purge(buf), spiRamFifoFill());
+        frame_data = fifo_peek_contiguous(player->fifo, &bytes_avail);
 
-        // Can't take anything?
-        if (bytes_to_read == 0) {
-
-            // EOF reached, stop decoder when all frames have been consumed
-            if(player->media_stream->eof) {
-                return MAD_FLOW_STOP;
-            }
-
-            //Wait until there is enough data in the buffer. This only happens when the data feed
-            //rate is too low, and shouldn't normally be needed!
-            ESP_LOGE(TAG, "Buffer underflow, need %d bytes.", buf_free_capacity_after_purge(buf));
-            buf_underrun_cnt++;
-            //We both silence the output as well as wait a while by pushing silent samples into the i2s system.
-            //This waits for about 200mS
-            renderer_zero_dma_buffer();
-            vTaskDelay(20 / portTICK_PERIOD_MS);
-        } else {
-            //Read some bytes from the FIFO to re-fill the buffer.
-            fill_read_buffer(buf);
+        // got something MAD hasn't seen yet?
+        if (bytes_avail > bytes_seen) {
+            break;
+        }
 
-            // break the loop if we have at least enough to decode a few of the smallest possible frame
-            //if(buf_data_unread(buf) >= (MIN_FRAME_SIZE * 4))
-                break;
+        // EOF reached, stop decoder when all frames have been consumed
+        if(player->media_stream->eof) {
+            return MAD_FLOW_STOP;
         }
+
+        //Wait until there is enough data in the buffer. This only happens when the data feed
+        //rate is too low, and shouldn't normally be needed!
+        ESP_LOGE(TAG, "Buffer underflow, have %d bytes.", bytes_avail);
+        st->buf_underrun_cnt++;
+        //Refill to the start threshold instead of resuming on the next packet
+        //and stuttering along. The renderer fades out if it runs dry meanwhile.
+        fifo_wait(player->fifo, audio_player_start_threshold(player), pdMS_TO_TICKS(200));
     }
 
     // Okay, let MAD decode the buffer.
-    mad_stream_buffer(stream, (unsigned char*) buf->read_pos, buf_data_unread(buf));
+    mad_stream_buffer(stream, (unsigned char*) frame_data, bytes_avail);
     return MAD_FLOW_CONTINUE;
 }
 
@@ -104,101 +138,183 @@ static enum mad_flow error(void *data, struct mad_stream *stream, struct mad_fra
 
 
 
-//This is the main mp3 decoding task. It will grab data from the input buffer FIFO in the SPI ram and
-//output it to the I2S port.
-void mp3_decoder_task(void *pvParameters)
+static mp3_state_t *alloc_mad_state(renderer_source_t source)
 {
-    player_t *player = pvParameters;
+    mp3_state_t *st = states[source];
+
+    if (st == NULL) {
+        st = calloc(1, sizeof(mp3_state_t));
+        if (st == NULL) { ESP_LOGE(TAG, "malloc(state) failed\n"); return NULL; }
+        st->source = source;
+        st->fmt.buffer_format = PCM_INTERLEAVED;
+        states[source] = st;
+    }
 
-    int ret;
-    struct mad_stream *stream;
-    struct mad_frame *frame;
-    struct mad_synth *synth;
+    if (st->stream == NULL)
+        st->stream = malloc(sizeof(struct mad_stream));
+    if (st->frame == NULL)
+        st->frame = malloc(sizeof(struct mad_frame));
 
-    //Allocate structs needed for mp3 decoding
-    stream = malloc(sizeof(struct mad_stream));
-    frame = malloc(sizeof(struct mad_frame));
-    synth = malloc(sizeof(struct mad_synth));
-    buffer_t *buf = buf_create(MAX_FRAME_SIZE);
+    if (st->stream==NULL) { ESP_LOGE(TAG, "malloc(stream) failed\n"); return NULL; }
+    if (st->frame==NULL) { ESP_LOGE(TAG, "malloc(frame) failed\n"); return NULL; }
 
-    if (stream==NULL) { ESP_LOGE(TAG, "malloc(stream) failed\n"); return; }
-    if (synth==NULL) { ESP_LOGE(TAG, "malloc(synth) failed\n"); return; }
-    if (frame==NULL) { ESP_LOGE(TAG, "malloc(frame) failed\n"); return; }
-    if (buf==NULL) { ESP_LOGE(TAG, "buf_create() failed\n"); return; }
+    return st;
+}
 
-    buf_underrun_cnt = 0;
+/* finds the first MPEG audio frame, ID3 tags are skipped by the caller */
+static int mp3_probe(const uint8_t *data, size_t len)
+{
+    return find_frame(data, len, AUDIO_MPEG);
+}
 
-    ESP_LOGI(TAG, "decoder start");
+static int mp3_open(player_t *player)
+{
+    mp3_state_t *st = alloc_mad_state(player->source);
+    if (st == NULL)
+        return -1;
 
-    //Initialize mp3 parts
-    mad_stream_init(stream);
-    mad_frame_init(frame);
-    mad_synth_init(synth);
+    st->buf_underrun_cnt = 0;
+    st->sample_block_frames = 0;
 
+    // quantise straight to what the renderer queues
+    renderer_get_format(&st->fmt);
 
-    while(1) {
+    ESP_LOGI(TAG, "decoder start, %d bit", st->fmt.bit_depth);
 
-        // calls mad_stream_buffer internally
-        if (input(stream, buf, player) == MAD_FLOW_STOP ) {
-            break;
-        }
+    //Initialize mp3 parts
+    mad_stream_init(st->stream);
+    mad_frame_init(st->frame);
+    mad_synth_init(&st->synth);
 
-        // decode frames until MAD complains
-        while(1) {
+    return 0;
+}
 
-            if(player->decoder_command == CMD_STOP) {
-                goto abort;
-            }
+//Decodes the next frame from the input buffer FIFO in the SPI ram and
+//outputs it to the I2S port. Runs on the decoder worker.
+static int mp3_decode_frame(player_t *player)
+{
+    mp3_state_t *st = states[player->source];
 
-            // returns 0 or -1
-            ret = mad_frame_decode(frame, stream);
-            if (ret == -1) {
-                if (!MAD_RECOVERABLE(stream->error)) {
-                    //We're most likely out of buffer and need to call input() again
-                    break;
-                }
-                error(NULL, stream, frame);
-                continue;
-            }
-            mad_synth_frame(synth, frame);
+    // returns 0 or -1
+    while (mad_frame_decode(st->frame, st->stream) == -1) {
+        if (MAD_RECOVERABLE(st->stream->error)) {
+            error(NULL, st->stream, st->frame);
+            continue;
+        }
+
+        //We're most likely out of buffer and need to call input() again,
+        //it calls mad_stream_buffer internally
+        if (input(st, player) == MAD_FLOW_STOP) {
+            return CODEC_EOF;
         }
-        // ESP_LOGI(TAG, "RAM left %d", esp_get_free_heap_size());
     }
 
-    abort:
-    // avoid noise
-    renderer_zero_dma_buffer();
+    mad_synth_frame(&st->synth, st->frame);
 
-    free(synth);
-    free(frame);
-    free(stream);
-    buf_destroy(buf);
+    // what is left of the frame goes out now, the next one may take a while
+    flush_sample_block(st);
+    return CODEC_OK;
+}
 
-    // clear semaphore for reader task
-    spiRamFifoReset();
+static void mp3_close(player_t *player)
+{
+    mp3_state_t *st = states[player->source];
 
-    player->decoder_status = STOPPED;
-    player->decoder_command = CMD_NONE;
-    ESP_LOGI(TAG, "decoder stopped");
+    if (st != NULL && st->buf_underrun_cnt > 0) {
+        ESP_LOGW(TAG, "%ld buffer underflows", st->buf_underrun_cnt);
+    }
+}
+
+const codec_t codec_mp3 = {
+    .name = "mp3",
+    .content_type = AUDIO_MPEG,
+    .stack_size = 8448,
+    .probe = mp3_probe,
+    .open = mp3_open,
+    .decode_frame = mp3_decode_frame,
+    .close = mp3_close
+};
 
-    ui_queue_event(UI_NONE);
+/* Called by the NXP modifications of libmad. Sets the needed output sample rate. */
+void set_dac_sample_rate(struct mad_synth *synth, int rate)
+{
+    mp3_state_t *st = state_of(synth);
 
-    ESP_LOGI(TAG, "MAD decoder stack: %d\n", uxTaskGetStackHighWaterMark(NULL));
-    vTaskDelete(NULL);
+    // gathered frames belong to the old rate
+    if (rate != st->fmt.sample_rate)
+        flush_sample_block(st);
+
+    st->fmt.sample_rate = rate;
 }
 
-/* Called by the NXP modifications of libmad. Sets the needed output sample rate. */
-void set_dac_sample_rate(int rate)
+/*
+ * The following utility routines perform simple rounding, clipping, and
+ * scaling of MAD's high-resolution samples down to 16 or 32 bits. They do
+ * not perform any dithering or noise shaping, which would be recommended to
+ * obtain any exceptional audio quality at 16 bits.
+ */
+static inline int16_t scale_16(mad_fixed_t sample)
+{
+    /* round */
+    sample += (1L << (MAD_F_FRACBITS - 16));
+
+    /* clip */
+    if (sample >= MAD_F_ONE)
+        sample = MAD_F_ONE - 1;
+    else if (sample < -MAD_F_ONE)
+        sample = -MAD_F_ONE;
+
+    /* quantize */
+    //The original nxp code had
+    //return sample >> (MAD_F_FRACBITS + 1 - 16);
+    //but somehow that clipped and distorted on loud sounds...
+    //This seems to be OK:
+    return sample >> (MAD_F_FRACBITS + 2 - 16);
+}
+
+/* same level as scale_16(), nothing to round */
+static inline int32_t scale_32(mad_fixed_t sample)
 {
-    mad_buffer_fmt.sample_rate = rate;
+    if (sample >= MAD_F_ONE)
+        sample = MAD_F_ONE - 1;
+    else if (sample < -MAD_F_ONE)
+        sample = -MAD_F_ONE;
+
+    return sample << (32 - 2 - MAD_F_FRACBITS);
 }
 
-/* render callback for the libmad synth */
-void render_sample_block(short *sample_buff_ch0, short *sample_buff_ch1, int num_samples, unsigned int num_channels)
+/* render callback for the libmad synth, mono is played on both channels */
+void render_sample_block(struct mad_synth *synth, mad_fixed_t *sample_buff_ch0, mad_fixed_t *sample_buff_ch1, int num_samples, unsigned int num_channels)
 {
-    mad_buffer_fmt.num_channels = num_channels;
-    uint32_t len = num_samples * sizeof(short) * num_channels;
-    render_samples((char*) sample_buff_ch0, len, &mad_buffer_fmt);
-    return;
+    mp3_state_t *st = state_of(synth);
+
+    if (num_channels == 1)
+        sample_buff_ch1 = sample_buff_ch0;
+
+    while (num_samples > 0) {
+        uint32_t frames = min(num_samples, PCM_BLOCK_FRAMES - st->sample_block_frames);
+
+        if (st->fmt.bit_depth == I2S_BITS_PER_SAMPLE_32BIT) {
+            int32_t *pcm = st->sample_block + 2 * st->sample_block_frames;
+            for (int i = 0; i < frames; i++) {
+                pcm[2 * i] = scale_32(sample_buff_ch0[i]);
+                pcm[2 * i + 1] = scale_32(sample_buff_ch1[i]);
+            }
+        } else {
+            int16_t *pcm = (int16_t *) st->sample_block + 2 * st->sample_block_frames;
+            for (int i = 0; i < frames; i++) {
+                pcm[2 * i] = scale_16(sample_buff_ch0[i]);
+                pcm[2 * i + 1] = scale_16(sample_buff_ch1[i]);
+            }
+        }
+
+        st->sample_block_frames += frames;
+        sample_buff_ch0 += frames;
+        sample_buff_ch1 += frames;
+        num_samples -= frames;
+
+        if (st->sample_block_frames == PCM_BLOCK_FRAMES)
+            flush_sample_block(st);
+    }
 }
 
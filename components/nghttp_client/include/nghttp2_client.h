@@ -66,6 +66,8 @@ void free_http2_session_data(http2_session_data_t *session_data, int ret);
 
 /**
  * @brief create a new session
+ *
+ * option may be NULL, it isn't referenced after the call returns
  */
 int nghttp_new_session(http2_session_data_t **http2_session_ptr,
                     char *uri, char *method,
@@ -73,6 +75,7 @@ int nghttp_new_session(http2_session_data_t **http2_session_ptr,
                     nghttp2_nv *headers,  size_t hdr_len,
                     nghttp2_data_provider *data_provider_struct,
                     nghttp2_session_callbacks *callbacks,
+                    nghttp2_option *option,
                     void *stream_user_data,
                     void *session_user_data);
 
@@ -375,11 +375,11 @@ int create_default_callbacks(nghttp2_session_callbacks **callbacks_ptr)
 /**
  *  *session_data is our handle
  */
-static int register_session_callbacks(nghttp2_session **session_ptr, nghttp2_session_callbacks *callbacks, void *user_data)
+static int register_session_callbacks(nghttp2_session **session_ptr, nghttp2_session_callbacks *callbacks, void *user_data, nghttp2_option *option)
 {
     int ret = 0;
 
-    ret = nghttp2_session_client_new(session_ptr, callbacks, user_data);
+    ret = nghttp2_session_client_new2(session_ptr, callbacks, user_data, option);
     nghttp2_session_callbacks_del(callbacks);
 
     return ret;
@@ -809,6 +809,7 @@ int nghttp_new_session(http2_session_data_t **http2_session_ptr,
         			nghttp2_nv *headers, size_t hdr_len,
 			        nghttp2_data_provider *data_provider_struct,
 			        nghttp2_session_callbacks *callbacks,
+			        nghttp2_option *option,
 			        void *stream_user_data,
 			        void *session_user_data)
 {
@@ -839,7 +840,7 @@ int nghttp_new_session(http2_session_data_t **http2_session_ptr,
     }
 
     // register callbacks
-    if((ret = register_session_callbacks(&session_data->h2_session, callbacks, session_data)) != 0) {
+    if((ret = register_session_callbacks(&session_data->h2_session, callbacks, session_data, option)) != 0) {
         url_free(url);
         return ret;
     }
@@ -14,9 +14,23 @@ typedef struct {
 
 } radio_controls_t;
 
-typedef struct {
+typedef enum
+{
+    HDR_NONE, HDR_CONTENT_TYPE
+} radio_header_t;
+
+typedef struct web_radio {
     char *url;
     player_t *player_config;
+
+    /* response parser state of the reader task, reset per request */
+    radio_header_t header_field;
+    content_type_t content_type;
+    bool headers_complete;
+
+    /* optional, called on the reader task when the download has ended */
+    void (*finished)(struct web_radio *radio);
+    void *user_data;
 } web_radio_t;
 
 void web_radio_init(web_radio_t *config);
@@ -23,42 +23,48 @@
 
 #define TAG "web_radio"
 
-typedef enum
-{
-    HDR_CONTENT_TYPE = 1
-} header_field_t;
-
-static header_field_t curr_header_field = 0;
-static content_type_t content_type = 0;
-static bool headers_complete = false;
-
 static int on_header_field_cb(http_parser *parser, const char *at, size_t length)
 {
+    web_radio_t *radio = parser->data;
+
     // convert to lower case
     unsigned char *c = (unsigned char *) at;
     for (; *c; ++c)
         *c = tolower(*c);
 
-    curr_header_field = 0;
+    radio->header_field = HDR_NONE;
     if (strstr(at, "content-type")) {
-        curr_header_field = HDR_CONTENT_TYPE;
+        radio->header_field = HDR_CONTENT_TYPE;
     }
 
     return 0;
 }
 
+static const struct {
+    const char *mime;
+    content_type_t content_type;
+} mime_types[] = {
+    { "application/octet-stream", OCTET_STREAM },
+    { "audio/aac", AUDIO_AAC },
+    { "audio/mp4", AUDIO_MP4 },
+    { "audio/x-m4a", AUDIO_MP4 },
+    { "audio/mpeg", AUDIO_MPEG }
+};
+
 static int on_header_value_cb(http_parser *parser, const char *at, size_t length)
 {
-    if (curr_header_field == HDR_CONTENT_TYPE) {
-        if (strstr(at, "application/octet-stream")) content_type = OCTET_STREAM;
-        if (strstr(at, "audio/aac")) content_type = AUDIO_AAC;
-        if (strstr(at, "audio/mp4")) content_type = AUDIO_MP4;
-        if (strstr(at, "audio/x-m4a")) content_type = AUDIO_MP4;
-        if (strstr(at, "audio/mpeg")) content_type = AUDIO_MPEG;
-
-        if(content_type == MIME_UNKNOWN) {
-            ESP_LOGE(TAG, "unknown content-type: %s", at);
-            return -1;
+    web_radio_t *radio = parser->data;
+
+    if (radio->header_field == HDR_CONTENT_TYPE) {
+        radio->content_type = MIME_UNKNOWN;
+        for (int i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+            if (strstr(at, mime_types[i].mime))
+                radio->content_type = mime_types[i].content_type;
+        }
+
+        // the player tells by the first bytes of the stream
+        if(radio->content_type == MIME_UNKNOWN) {
+            ESP_LOGW(TAG, "unknown content-type: %s", at);
         }
     }
 
@@ -67,10 +73,11 @@ static int on_header_value_cb(http_parser *parser, const char *at, size_t length
 
 static int on_headers_complete_cb(http_parser *parser)
 {
-    headers_complete = true;
-    player_t *player_config = parser->data;
+    web_radio_t *radio = parser->data;
+    player_t *player_config = radio->player_config;
 
-    player_config->media_stream->content_type = content_type;
+    radio->headers_complete = true;
+    player_config->media_stream->content_type = radio->content_type;
     player_config->media_stream->eof = false;
 
     audio_player_start(player_config);
@@ -80,13 +87,17 @@ static int on_headers_complete_cb(http_parser *parser)
 
 static int on_body_cb(http_parser* parser, const char *at, size_t length)
 {
-    return audio_stream_consumer(at, length, parser->data);
+    web_radio_t *radio = parser->data;
+    return audio_stream_consumer(at, length, radio->player_config);
 }
 
 static int on_message_complete_cb(http_parser *parser)
 {
-    player_t *player_config = parser->data;
+    web_radio_t *radio = parser->data;
+    player_t *player_config = radio->player_config;
     player_config->media_stream->eof = true;
+    // ensure flush
+    audio_stream_consumer(NULL, 0, player_config);
 
     return 0;
 }
@@ -103,9 +114,13 @@ static void http_get_task(void *pvParameters)
     callbacks.on_headers_complete = on_headers_complete_cb;
     callbacks.on_message_complete = on_message_complete_cb;
 
+    // nothing of the previous response carries over
+    radio_conf->header_field = HDR_NONE;
+    radio_conf->content_type = MIME_UNKNOWN;
+    radio_conf->headers_complete = false;
+
     // blocks until end of stream
-    int result = http_client_get(radio_conf->url, &callbacks,
-            radio_conf->player_config);
+    int result = http_client_get(radio_conf->url, &callbacks, radio_conf);
 
     if (result != 0) {
         ESP_LOGE(TAG, "http_client_get error");
@@ -114,6 +129,10 @@ static void http_get_task(void *pvParameters)
     }
     // ESP_LOGI(TAG, "http_client_get stack: %d\n", uxTaskGetStackHighWaterMark(NULL));
 
+    if (radio_conf->finished != NULL) {
+        radio_conf->finished(radio_conf);
+    }
+
     vTaskDelete(NULL);
 }
 
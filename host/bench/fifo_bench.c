@@ -0,0 +1,93 @@
+/*
+ * fifo_bench.c
+ *
+ * Throughput of the default FIFO between two tasks, and the semaphore
+ * operations it costs. The writer pushes 4 KB network-sized chunks, the
+ * reader takes 2889 bytes at a time so the two never line up. Only the
+ * spiRamFifo* API is used, it builds against every version of the FIFO.
+ *
+ * Semaphore takes and gives are counted by wrapping xQueueReceive and
+ * xQueueSend at link time, see the Makefile.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "spiram_fifo.h"
+
+#define TOTAL_BYTES (256L * 1024 * 1024)
+#define WRITE_CHUNK 4096
+#define READ_CHUNK 2889
+
+static volatile long sem_takes;
+static volatile long sem_gives;
+
+BaseType_t __real_xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t __real_xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+
+/* a semaphore is a queue without items */
+BaseType_t __wrap_xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    if (item == NULL) __atomic_add_fetch(&sem_takes, 1, __ATOMIC_RELAXED);
+    return __real_xQueueReceive(queue, item, ticks);
+}
+
+BaseType_t __wrap_xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    if (item == NULL) __atomic_add_fetch(&sem_gives, 1, __ATOMIC_RELAXED);
+    return __real_xQueueSend(queue, item, ticks);
+}
+
+static void writer_task(void *pvParameters)
+{
+    static char chunk[WRITE_CHUNK];
+    memset(chunk, 0x55, sizeof(chunk));
+
+    for (long done = 0; done < TOTAL_BYTES; done += WRITE_CHUNK) {
+        spiRamFifoWrite(chunk, WRITE_CHUNK);
+    }
+
+    vTaskDelete(NULL);
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    static char chunk[READ_CHUNK];
+
+    if (!spiRamFifoInit()) {
+        fprintf(stderr, "fifo init failed\n");
+        return 1;
+    }
+    sem_takes = sem_gives = 0;
+
+    double start = now_sec();
+    xTaskCreate(writer_task, "writer", 4096, NULL, 5, NULL);
+
+    for (long done = 0; done < TOTAL_BYTES; ) {
+        int n = (TOTAL_BYTES - done < READ_CHUNK) ? TOTAL_BYTES - done : READ_CHUNK;
+        spiRamFifoRead(chunk, n);
+        done += n;
+    }
+    double elapsed = now_sec() - start;
+
+    double mb = TOTAL_BYTES / (1024.0 * 1024.0);
+    printf("%.0f MB in %.2f s: %.0f MB/s, %.1f semaphore takes and %.1f gives per MB\n",
+            mb, elapsed, mb / elapsed, sem_takes / mb, sem_gives / mb);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * pcm_bench.c
+ *
+ * Block conversion with pcm_convert.c against the per-frame push that
+ * render_samples() did before it, for one 1152 frame MP3 granule. The
+ * per-frame loop is the old code with i2s_push_sample() replaced by a
+ * copy under a mutex, standing in for the driver lock. Blocks go through
+ * the same lock once per PCM_BLOCK_FRAMES. Both have to produce the same
+ * bytes.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "audio_renderer.h"
+#include "pcm_convert.h"
+
+#define GRANULE_FRAMES 1152
+#define ITERATIONS 20000
+
+/* what the "driver" got, wraps around. Larger than one granule, so the
+ * output of a single run can be compared. */
+#define SINK_SIZE (512 * 1024)
+
+static pthread_mutex_t driver_lock = PTHREAD_MUTEX_INITIALIZER;
+static char sink[SINK_SIZE];
+static size_t sink_pos;
+
+static __attribute__((noinline)) int driver_write(const char *src, size_t len)
+{
+    pthread_mutex_lock(&driver_lock);
+    size_t off = sink_pos % SINK_SIZE;
+    if (off + len > SINK_SIZE) off = 0;
+    memcpy(sink + off, src, len);
+    sink_pos += len;
+    pthread_mutex_unlock(&driver_lock);
+    return len;
+}
+
+/* render_samples() before pcm_convert.c, 16 bit input */
+static void per_frame(char *buf, int frames, const pcm_format_t *fmt,
+        output_mode_t output_mode, i2s_bits_per_sample_t bit_depth)
+{
+    char *ptr_l = buf;
+    char *ptr_r = buf + 2;
+    uint8_t stride = 4;
+
+    if (fmt->buffer_format == PCM_LEFT_RIGHT) {
+        ptr_r = buf + frames * 2;
+        stride = 2;
+    }
+
+    if (fmt->num_channels == 1) {
+        ptr_r = ptr_l;
+        stride = 2;
+    }
+
+    for (int i = 0; i < frames; i++) {
+        if (output_mode == DAC_BUILT_IN) {
+            short left = *(short *) ptr_l;
+            short right = *(short *) ptr_r;
+            left = left + 0x8000;
+            right = right + 0x8000;
+
+            uint32_t sample = (uint16_t) left;
+            sample = (sample << 16 & 0xffff0000) | ((uint16_t) right);
+            driver_write((const char *) &sample, 4);
+        } else if (bit_depth == I2S_BITS_PER_SAMPLE_16BIT) {
+            const char samp32[4] = {ptr_l[0], ptr_l[1], ptr_r[0], ptr_r[1]};
+            driver_write(samp32, 4);
+        } else {
+            const char samp64[8] = {0, 0, ptr_l[0], ptr_l[1], 0, 0, ptr_r[0], ptr_r[1]};
+            driver_write(samp64, 8);
+        }
+
+        ptr_l += stride;
+        ptr_r += stride;
+    }
+}
+
+static void blocks(char *buf, int frames, pcm_format_t *fmt,
+        output_mode_t output_mode, i2s_bits_per_sample_t bit_depth)
+{
+    static uint8_t out[PCM_BLOCK_FRAMES * PCM_MAX_FRAME_BYTES];
+    pcm_converter_t conv;
+    pcm_converter_init(&conv, fmt, output_mode, bit_depth);
+
+    const int16_t *left = (const int16_t *) buf;
+    const int16_t *right = left + 1;
+    if (fmt->buffer_format == PCM_LEFT_RIGHT) right = left + frames;
+    if (fmt->num_channels == 1) right = left;
+
+    while (frames > 0) {
+        int n = (frames < PCM_BLOCK_FRAMES) ? frames : PCM_BLOCK_FRAMES;
+        conv.convert(left, right, out, n);
+        driver_write((const char *) out, n * conv.out_frame_bytes);
+        left += n * conv.in_stride;
+        right += n * conv.in_stride;
+        frames -= n;
+    }
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    static const struct {
+        const char *name;
+        uint8_t num_channels;
+        pcm_buffer_layout_t layout;
+        output_mode_t output_mode;
+        i2s_bits_per_sample_t bit_depth;
+    } cases[] = {
+        { "interleaved -> 32 bit", 2, PCM_INTERLEAVED, I2S_MERUS, I2S_BITS_PER_SAMPLE_32BIT },
+        { "planar -> 16 bit", 2, PCM_LEFT_RIGHT, I2S, I2S_BITS_PER_SAMPLE_16BIT },
+        { "planar -> 32 bit", 2, PCM_LEFT_RIGHT, I2S_MERUS, I2S_BITS_PER_SAMPLE_32BIT },
+        { "mono -> 16 bit", 1, PCM_INTERLEAVED, I2S, I2S_BITS_PER_SAMPLE_16BIT },
+        { "interleaved -> DAC", 2, PCM_INTERLEAVED, DAC_BUILT_IN, I2S_BITS_PER_SAMPLE_16BIT },
+        { "planar -> DAC", 2, PCM_LEFT_RIGHT, DAC_BUILT_IN, I2S_BITS_PER_SAMPLE_16BIT },
+    };
+    static char ref[GRANULE_FRAMES * PCM_MAX_FRAME_BYTES];
+    int bad = 0;
+
+    char *buf = malloc(GRANULE_FRAMES * 4);
+    for (int i = 0; i < GRANULE_FRAMES * 2; i++) {
+        ((int16_t *) buf)[i] = rand();
+    }
+
+    for (int k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        pcm_format_t fmt = {
+            .sample_rate = 44100,
+            .bit_depth = I2S_BITS_PER_SAMPLE_16BIT,
+            .num_channels = cases[k].num_channels,
+            .buffer_format = cases[k].layout
+        };
+
+        sink_pos = 0;
+        per_frame(buf, GRANULE_FRAMES, &fmt, cases[k].output_mode, cases[k].bit_depth);
+        size_t ref_len = sink_pos;
+        memcpy(ref, sink, ref_len);
+
+        sink_pos = 0;
+        blocks(buf, GRANULE_FRAMES, &fmt, cases[k].output_mode, cases[k].bit_depth);
+        bool same = (sink_pos == ref_len && memcmp(ref, sink, ref_len) == 0);
+        if (!same) bad++;
+
+        double t0 = now_sec();
+        for (int i = 0; i < ITERATIONS; i++) {
+            per_frame(buf, GRANULE_FRAMES, &fmt, cases[k].output_mode, cases[k].bit_depth);
+        }
+        double t1 = now_sec();
+        for (int i = 0; i < ITERATIONS; i++) {
+            blocks(buf, GRANULE_FRAMES, &fmt, cases[k].output_mode, cases[k].bit_depth);
+        }
+        double t2 = now_sec();
+
+        double frames = (double) ITERATIONS * GRANULE_FRAMES;
+        printf("%-22s %s  per frame %5.1f ns/frame, blocks %4.1f ns/frame\n", cases[k].name,
+                same ? "same" : "DIFF", (t1 - t0) / frames * 1e9, (t2 - t1) / frames * 1e9);
+    }
+
+    free(buf);
+    return bad;
+}
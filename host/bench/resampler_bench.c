@@ -0,0 +1,162 @@
+/*
+ * resampler_bench.c
+ *
+ * Speed and quality of resampler.c. Input is fed in 1152 frame chunks like
+ * MP3 granules, output is taken 256 frames at a time.
+ *
+ * speed: best of 5 runs over 200k random stereo input frames, in CPU
+ * cycles per output frame on x86, ns elsewhere.
+ *
+ * quality: a -1 dBFS sine, least-squares fitted at the output frequency
+ * after the filter has settled. Gain is the fitted amplitude against the
+ * input, THD+N the residual against the fit.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIME_UNIT "cycles"
+static uint64_t now_ticks()
+{
+    return __rdtsc();
+}
+#else
+#define TIME_UNIT "ns"
+static uint64_t now_ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+#include "resampler.h"
+
+#define IN_FRAMES 200000
+#define CHUNK_FRAMES 1152
+#define OUT_CHUNK_FRAMES 256
+
+/* skipped at both ends of the quality fit */
+#define SETTLE_FRAMES 2000
+
+static int16_t in[IN_FRAMES * 2];
+static int16_t out[IN_FRAMES * 2 * RESAMPLER_MAX_DECIMATION];
+
+/* everything in in[] through the resampler, returns the output frames */
+static size_t run(resampler_t *rs)
+{
+    size_t produced = 0;
+
+    for (size_t off = 0; off < IN_FRAMES; off += CHUNK_FRAMES) {
+        size_t left = (IN_FRAMES - off < CHUNK_FRAMES) ? IN_FRAMES - off : CHUNK_FRAMES;
+        const int16_t *p = in + 2 * off;
+        size_t got;
+
+        do {
+            size_t taken = left;
+            got = resampler_process(rs, p, p + 1, 2, &taken, out + 2 * produced, OUT_CHUNK_FRAMES);
+            produced += got;
+            p += 2 * taken;
+            left -= taken;
+        } while (left > 0 || got > 0);
+    }
+
+    return produced;
+}
+
+static void speed(uint32_t in_rate, uint32_t out_rate, float modifier)
+{
+    resampler_t *rs = resampler_create();
+    resampler_set_rates(rs, in_rate, out_rate, modifier);
+
+    for (int i = 0; i < IN_FRAMES * 2; i++) {
+        in[i] = rand();
+    }
+
+    run(rs);
+    uint64_t best = UINT64_MAX;
+    size_t n = 0;
+    for (int r = 0; r < 5; r++) {
+        uint64_t t0 = now_ticks();
+        n = run(rs);
+        uint64_t t = now_ticks() - t0;
+        if (t < best) best = t;
+    }
+
+    printf("  %5u -> %5u x %.2f: %5.1f %s per stereo output frame\n", in_rate, out_rate,
+            modifier, (double) best / n, TIME_UNIT);
+    resampler_destroy(rs);
+}
+
+static void quality(uint32_t in_rate, uint32_t out_rate, float modifier, double freq)
+{
+    resampler_t *rs = resampler_create();
+    resampler_set_rates(rs, in_rate, out_rate, modifier);
+
+    double amp = 0.89 * 32767;
+    for (int i = 0; i < IN_FRAMES; i++) {
+        in[2 * i] = in[2 * i + 1] = lrint(amp * sin(2 * M_PI * freq * i / in_rate));
+    }
+
+    size_t n = run(rs);
+
+    // the modifier plays the input faster, the tone moves with it
+    double w = 2 * M_PI * freq * (double) (float) (in_rate * modifier) / in_rate / out_rate;
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (size_t i = SETTLE_FRAMES; i < n - SETTLE_FRAMES; i++) {
+        double s = sin(w * i), c = cos(w * i), y = out[2 * i];
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        ys += y * s;
+        yc += y * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+
+    double sig = 0, err = 0;
+    for (size_t i = SETTLE_FRAMES; i < n - SETTLE_FRAMES; i++) {
+        double m = a * sin(w * i) + b * cos(w * i);
+        sig += m * m;
+        err += (out[2 * i] - m) * (out[2 * i] - m);
+    }
+
+    printf("  %5u -> %5u x %.2f %5.0f Hz: gain %+5.1f dB, THD+N %5.1f dB\n", in_rate, out_rate,
+            modifier, freq, 20 * log10(sqrt(a * a + b * b) / amp), 10 * log10(err / sig));
+    resampler_destroy(rs);
+}
+
+int main()
+{
+    printf("speed\n");
+    speed(44100, 48000, 1);
+    speed(24000, 48000, 1);
+    speed(16000, 48000, 1);
+    speed(48000, 44100, 1);
+    speed(44100, 48000, 1.01f);
+
+    printf("quality\n");
+    quality(44100, 48000, 1, 1000);
+    quality(44100, 48000, 1, 10000);
+    quality(44100, 48000, 1, 16000);
+    quality(44100, 48000, 1, 19000);
+    quality(24000, 48000, 1, 1000);
+    quality(24000, 48000, 1, 10000);
+    quality(16000, 48000, 1, 1000);
+    quality(16000, 48000, 1, 6000);
+    quality(48000, 44100, 1, 1000);
+    quality(48000, 44100, 1, 19000);
+    quality(44100, 48000, 1.01f, 1000);
+    quality(44100, 48000, 1.01f, 10000);
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * playerconfig.h
+ *
+ * Stands in for main/include/playerconfig.h in the SPI RAM benchmark. It
+ * leaves FAKE_SPI_BUFF undefined, so SPI RAM backed FIFOs really go
+ * through spiRamRead/spiRamWrite.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef _PLAYER_CONFIG_H_
+#define _PLAYER_CONFIG_H_
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * spiram_calls.c
+ *
+ * For trees before spiram.c, which declared spiRamRead/spiRamWrite without
+ * a driver behind them. Every call counts as one bus transaction, fifo.c
+ * kept them within what one transaction carries.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "spiram.h"
+
+static char chip[SPIRAMSIZE];
+static uint32_t transaction_cnt = 0;
+
+void spiRamInit()
+{
+}
+
+int spiRamTest()
+{
+    return 1;
+}
+
+void spiRamRead(int addr, char *buff, int len)
+{
+    memcpy(buff, chip + addr, len);
+    transaction_cnt++;
+}
+
+void spiRamWrite(int addr, char *buff, int len)
+{
+    memcpy(chip + addr, buff, len);
+    transaction_cnt++;
+}
+
+uint32_t spiRamTransactionCount()
+{
+    return transaction_cnt;
+}
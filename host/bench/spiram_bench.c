@@ -0,0 +1,71 @@
+/*
+ * spiram_bench.c
+ *
+ * SPI RAM bus transactions per MB through a SPI RAM backed FIFO. Data comes
+ * in like a download, 1460 byte writes, and leaves like MP3 frames: one
+ * fifo_peek_contiguous() and a 418 byte fifo_consume() per frame, while a
+ * whole frame is there. The content is checked on the way out. Counts are
+ * per MB streamed.
+ *
+ * Built twice, spiram_bench and spiram_dma_bench with SPIRAM_DMA.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "fifo.h"
+#include "spiram.h"
+
+#define TOTAL_BYTES (1024 * 1024)
+#define FIFO_SIZE (64 * 1024)
+#define WRITE_CHUNK 1460
+#define FRAME_SIZE 418
+
+/* declared by spiram.h only since the driver */
+uint32_t spiRamTransactionCount();
+
+int main()
+{
+    static char chunk[WRITE_CHUNK];
+    uint32_t written = 0, read = 0, bad = 0;
+
+    if (!fifo_init()) {
+        fprintf(stderr, "SPI RAM test failed\n");
+        return 1;
+    }
+
+    fifo_t *fifo = fifo_create(FIFO_SIZE, FIFO_BACKING_SPIRAM);
+    if (fifo == NULL) {
+        fprintf(stderr, "fifo_create failed\n");
+        return 1;
+    }
+
+    uint32_t start = spiRamTransactionCount();
+
+    while (written < TOTAL_BYTES) {
+        for (int i = 0; i < WRITE_CHUNK; i++) {
+            chunk[i] = (char) ((written + i) * 7);
+        }
+        fifo_write(fifo, chunk, WRITE_CHUNK);
+        written += WRITE_CHUNK;
+
+        while (fifo_fill(fifo) >= FRAME_SIZE) {
+            int len;
+            char *frame = fifo_peek_contiguous(fifo, &len);
+            for (int i = 0; i < FRAME_SIZE; i++) {
+                if (frame[i] != (char) ((read + i) * 7)) bad++;
+            }
+            fifo_consume(fifo, FRAME_SIZE);
+            read += FRAME_SIZE;
+        }
+    }
+
+    uint32_t transactions = spiRamTransactionCount() - start;
+    printf("%u bytes in, %u bytes out, %u corrupt: %.0f transactions per MB\n",
+            written, read, bad, transactions / (written / (1024.0 * 1024.0)));
+
+    return bad != 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * gpio.h
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_GPIO_H_
+#define HOST_GPIO_H_
+
+typedef int gpio_num_t;
+
+#endif /* HOST_GPIO_H_ */
@@ -0,0 +1,43 @@
+/*
+ * i2s.h
+ *
+ * The I2S types the renderer passes around. There is no driver, the host
+ * build has no I2S sink.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_I2S_H_
+#define HOST_I2S_H_
+
+#include <stddef.h>
+
+#include "driver/gpio.h"
+
+typedef enum {
+    I2S_BITS_PER_SAMPLE_8BIT = 8,
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+    I2S_BITS_PER_SAMPLE_24BIT = 24,
+    I2S_BITS_PER_SAMPLE_32BIT = 32
+} i2s_bits_per_sample_t;
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+    I2S_NUM_MAX
+} i2s_port_t;
+
+typedef enum {
+    I2S_EVENT_DMA_ERROR = 0,
+    I2S_EVENT_TX_DONE,
+    I2S_EVENT_RX_DONE,
+    I2S_EVENT_MAX
+} i2s_event_type_t;
+
+typedef struct {
+    i2s_event_type_t type;
+    size_t size;
+} i2s_event_t;
+
+#endif /* HOST_I2S_H_ */
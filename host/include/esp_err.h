@@ -0,0 +1,29 @@
+/*
+ * esp_err.h
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_ESP_ERR_H_
+#define HOST_ESP_ERR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+
+#define ESP_ERROR_CHECK(x) do {                                         \
+        esp_err_t rc_ = (x);                                            \
+        if (rc_ != ESP_OK) {                                            \
+            fprintf(stderr, "%s:%d: %s failed: %d\n", __FILE__, __LINE__, #x, rc_); \
+            abort();                                                    \
+        }                                                               \
+    } while (0)
+
+#endif /* HOST_ESP_ERR_H_ */
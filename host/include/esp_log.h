@@ -0,0 +1,31 @@
+/*
+ * esp_log.h
+ *
+ * Logs to stderr in the format of the ESP-IDF, without colors. Debug and
+ * verbose messages are left out.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/* ms since the start */
+uint32_t esp_log_timestamp(void);
+
+#define HOST_LOG(letter, tag, format, ...) \
+    fprintf(stderr, letter " (%u) %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+#define ESP_LOGV(tag, format, ...) do {} while (0)
+
+#endif /* HOST_ESP_LOG_H_ */
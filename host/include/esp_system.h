@@ -0,0 +1,16 @@
+/*
+ * esp_system.h
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+/* the host doesn't run out, always 0 */
+uint32_t esp_get_free_heap_size(void);
+
+#endif /* HOST_ESP_SYSTEM_H_ */
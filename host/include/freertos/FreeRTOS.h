@@ -0,0 +1,48 @@
+/*
+ * FreeRTOS.h
+ *
+ * The part of FreeRTOS the decode pipeline uses, on top of pthreads. See
+ * port/freertos_host.c. One tick is a millisecond.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+typedef struct host_task *TaskHandle_t;
+typedef struct host_queue *QueueHandle_t;
+typedef struct host_queue *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* older names, still in use */
+typedef QueueHandle_t xQueueHandle;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+
+#define configMAX_PRIORITIES 25
+#define configTICK_RATE_HZ 1000
+
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms) * configTICK_RATE_HZ / 1000)
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define IRAM_ATTR
+
+#endif /* HOST_FREERTOS_H_ */
@@ -0,0 +1,28 @@
+/*
+ * semphr.h
+ *
+ * Semaphores are queues without items, like in FreeRTOS. A mutex doesn't
+ * inherit priorities.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_SEMPHR_H_
+#define HOST_SEMPHR_H_
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+/* the old API, the semaphore starts out given */
+#define vSemaphoreCreateBinary(sem) \
+    do { (sem) = xSemaphoreCreateBinary(); if ((sem) != NULL) xSemaphoreGive(sem); } while (0)
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
+
+#define xSemaphoreTake(sem, ticks) xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem) xQueueSend(sem, NULL, 0)
+
+#endif /* HOST_SEMPHR_H_ */
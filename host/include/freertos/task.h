@@ -0,0 +1,36 @@
+/*
+ * task.h
+ *
+ * Tasks are threads. A task gets more stack than it asks for, 64 bit code
+ * takes more than the ESP32's.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include <sched.h>
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth,
+        void *parameters, UBaseType_t priority, TaskHandle_t *created, BaseType_t core);
+#define xTaskCreate(code, name, stack_depth, parameters, priority, created) \
+    xTaskCreatePinnedToCore(code, name, stack_depth, parameters, priority, created, 0)
+
+/* only a task deleting itself */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+#define taskYIELD() sched_yield()
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/* nothing to measure, always 0 */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+#endif /* HOST_TASK_H_ */
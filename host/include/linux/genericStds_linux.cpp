@@ -0,0 +1,9 @@
+/*
+ * genericStds_linux.cpp
+ *
+ * Left out of the FDK AAC copy in components/. Nothing here, the generic
+ * versions in genericStds.cpp are used.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
@@ -0,0 +1,19 @@
+/*
+ * sdkconfig.h
+ *
+ * What 'make menuconfig' would set for the host build. Only the options
+ * the decode pipeline looks at.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_SDKCONFIG_H_
+#define HOST_SDKCONFIG_H_
+
+#define CONFIG_AUDIO_OUTPUT_MODE 0
+#define CONFIG_AUDIO_OUTPUT_SAMPLE_RATE 0
+#define CONFIG_WIFI_SSID ""
+#define CONFIG_WIFI_PASSWORD ""
+
+#endif /* HOST_SDKCONFIG_H_ */
@@ -0,0 +1,19 @@
+/*
+ * soc_memory_layout.h
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#ifndef HOST_SOC_MEMORY_LAYOUT_H_
+#define HOST_SOC_MEMORY_LAYOUT_H_
+
+#include <stdbool.h>
+
+/* there is no flash to tell apart, alignment is still checked by callers */
+static inline bool esp_ptr_dma_capable(const void *p)
+{
+    return true;
+}
+
+#endif /* HOST_SOC_MEMORY_LAYOUT_H_ */
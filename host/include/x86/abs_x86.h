@@ -0,0 +1,9 @@
+/*
+ * abs_x86.h
+ *
+ * The FDK AAC copy in components/ only has the Xtensa versions. Nothing
+ * here, abs.h falls back to its portable C code.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
@@ -0,0 +1,181 @@
+/*
+ * player_host.c
+ *
+ * Plays a file through the decode pipeline on a Linux host: audio player,
+ * codec, renderer and the WAV or null sink, the code that runs on the ESP32.
+ * The file is fed like a download, the WAV file holds what I2S would have
+ * got. Compare it with the output of an earlier build for bit-exactness,
+ * or use -n for the throughput.
+ *
+ *   player_host [-n] [-b 16|32] [-r rate] [-t mp3|aac|mp4] input [output.wav]
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "audio_player.h"
+#include "audio_renderer.h"
+#include "renderer_sink.h"
+#include "fifo.h"
+
+#define TAG "player_host"
+
+/* about one TCP segment, like the HTTP client hands them over */
+#define FEED_CHUNK 1460
+
+/* the renderer is done once the position stops moving this long */
+#define PLAYED_POLL_MS 100
+
+static SemaphoreHandle_t stream_finished;
+
+static void on_stream_done(player_t *player)
+{
+    xSemaphoreGive(stream_finished);
+}
+
+static content_type_t parse_content_type(const char *name)
+{
+    if (strcmp(name, "mp3") == 0)
+        return AUDIO_MPEG;
+    if (strcmp(name, "aac") == 0)
+        return AUDIO_AAC;
+    if (strcmp(name, "mp4") == 0)
+        return AUDIO_MP4;
+
+    return MIME_UNKNOWN;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: player_host [-n] [-b 16|32] [-r rate] [-t mp3|aac|mp4] input [output.wav]\n"
+            "  -n  null sink, report the throughput instead of writing a file\n"
+            "  -b  output bit depth, 16 by default\n"
+            "  -r  fixed output rate, streams are resampled to it\n"
+            "  -t  content type as a server would announce it, sniffed if left out\n");
+    exit(2);
+}
+
+/* hands the file to the player in chunks, as the HTTP client would */
+static int feed(player_t *player, FILE *in)
+{
+    char buf[FEED_CHUNK];
+    size_t len;
+
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (audio_stream_consumer(buf, len, player) != 0)
+            return -1;
+    }
+
+    // starts a short stream that never reached the threshold
+    player->media_stream->eof = true;
+    return audio_stream_consumer(buf, 0, player);
+}
+
+/* the WAV sink has to see every frame before it is closed */
+static void wait_played(player_t *player)
+{
+    uint32_t position = player_get_position_ms(player);
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(PLAYED_POLL_MS));
+        uint32_t now = player_get_position_ms(player);
+        if (now == position)
+            break;
+        position = now;
+    }
+
+    ESP_LOGI(TAG, "played %u ms", position);
+}
+
+int main(int argc, char **argv)
+{
+    renderer_config_t renderer_config = {
+        .output_mode = I2S,
+        .sample_rate = 44100,
+        .sample_rate_modifier = 1.0,
+        .latency = LATENCY_NORMAL,
+        .bit_depth = I2S_BITS_PER_SAMPLE_16BIT,
+        .i2s_num = I2S_NUM_0,
+        .sink = &renderer_sink_wav
+    };
+    media_stream_t media_stream = {
+        .content_type = MIME_UNKNOWN
+    };
+    player_t player = {
+        .command = CMD_NONE,
+        .decoder_status = UNINITIALIZED,
+        .decoder_command = CMD_NONE,
+        .buffer_pref = BUF_PREF_SAFE,
+        .source = RENDERER_SOURCE_CONTENT,
+        .media_stream = &media_stream,
+        .stream_done = on_stream_done
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "nb:r:t:")) != -1) {
+        switch (opt) {
+            case 'n':
+                renderer_config.sink = &renderer_sink_null;
+                break;
+            case 'b':
+                renderer_config.bit_depth = atoi(optarg) == 32
+                        ? I2S_BITS_PER_SAMPLE_32BIT : I2S_BITS_PER_SAMPLE_16BIT;
+                break;
+            case 'r':
+                renderer_config.output_sample_rate = atoi(optarg);
+                break;
+            case 't':
+                media_stream.content_type = parse_content_type(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind >= argc)
+        usage();
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    renderer_config.sink_path = optind + 1 < argc ? argv[optind + 1] : "out.wav";
+
+    fifo_init();
+    player.fifo = fifo_create(PLAYER_FIFO_SIZE, FIFO_BACKING_RAM);
+    stream_finished = xSemaphoreCreateBinary();
+
+    renderer_init(&renderer_config);
+    audio_player_init(&player);
+    audio_player_start(&player);
+
+    if (feed(&player, in) != 0) {
+        ESP_LOGE(TAG, "the player didn't take %s", argv[optind]);
+        return 1;
+    }
+    fclose(in);
+
+    if (player.decoder_status == UNINITIALIZED) {
+        ESP_LOGE(TAG, "%s is too short to play", argv[optind]);
+        return 1;
+    }
+
+    xSemaphoreTake(stream_finished, portMAX_DELAY);
+    wait_played(&player);
+
+    renderer_stop();
+    audio_player_destroy();
+
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * freertos_host.c
+ *
+ * FreeRTOS tasks, notifications, queues and semaphores on pthreads. Enough
+ * for the decode pipeline, priorities and cores are ignored.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#define TAG "freertos_host"
+
+/* 64 bit code and glibc take more stack than the ESP32 */
+#define HOST_STACK_FACTOR 4
+#define HOST_STACK_MIN (64 * 1024)
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *parameters;
+
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notify_count;
+};
+
+/* a semaphore is a queue with item_size 0, only count matters then */
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;
+};
+
+static __thread struct host_task *current_task;
+static struct timespec start_time;
+
+static void monotonic_now(struct timespec *ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+__attribute__((constructor))
+static void host_clock_init()
+{
+    monotonic_now(&start_time);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    struct timespec now;
+    monotonic_now(&now);
+
+    return (now.tv_sec - start_time.tv_sec) * 1000
+            + (now.tv_nsec - start_time.tv_nsec) / 1000000;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return pdMS_TO_TICKS(esp_log_timestamp());
+}
+
+/* absolute CLOCK_MONOTONIC deadline for the condition variables */
+static void deadline(struct timespec *ts, TickType_t ticks)
+{
+    uint64_t ms = (uint64_t) ticks * portTICK_PERIOD_MS;
+
+    monotonic_now(ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* waits on cond until ready() or the ticks are over, with lock held */
+static bool wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+        bool (*ready)(void *arg), void *arg)
+{
+    struct timespec until;
+
+    if (ticks != portMAX_DELAY)
+        deadline(&until, ticks);
+
+    while (!ready(arg)) {
+        if (ticks == 0)
+            return false;
+
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, lock);
+        } else if (pthread_cond_timedwait(cond, lock, &until) == ETIMEDOUT) {
+            return ready(arg);
+        }
+    }
+
+    return true;
+}
+
+static struct host_task *task_alloc(TaskFunction_t code, void *parameters)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (task == NULL)
+        return NULL;
+
+    task->code = code;
+    task->parameters = parameters;
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->notified);
+
+    return task;
+}
+
+static void *task_entry(void *arg)
+{
+    struct host_task *task = arg;
+
+    current_task = task;
+    task->code(task->parameters);
+
+    // a task function must not return
+    ESP_LOGE(TAG, "task returned without vTaskDelete()");
+    abort();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth,
+        void *parameters, UBaseType_t priority, TaskHandle_t *created, BaseType_t core)
+{
+    struct host_task *task = task_alloc(code, parameters);
+    if (task == NULL)
+        return pdFAIL;
+
+    size_t stack_size = (size_t) stack_depth * HOST_STACK_FACTOR;
+    if (stack_size < HOST_STACK_MIN)
+        stack_size = HOST_STACK_MIN;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    // the handle has to be there before the task runs
+    if (created != NULL)
+        *created = task;
+
+    int err = pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        ESP_LOGE(TAG, "can't start %s: %s", name, strerror(err));
+        if (created != NULL)
+            *created = NULL;
+        free(task);
+        return pdFAIL;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != current_task) {
+        ESP_LOGE(TAG, "only a task can delete itself here");
+        return;
+    }
+
+    // the handle may still be notified, it stays allocated
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t ms = (uint64_t) ticks * portTICK_PERIOD_MS;
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000
+    };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+/* threads not started by xTaskCreate(), main() for one, get a handle too */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current_task == NULL)
+        current_task = task_alloc(NULL, NULL);
+
+    return current_task;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+
+    return pdPASS;
+}
+
+static bool task_notified(void *arg)
+{
+    return ((struct host_task *) arg)->notify_count > 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+
+    pthread_mutex_lock(&task->lock);
+    wait_until(&task->notified, &task->lock, ticks, task_notified, task);
+
+    uint32_t count = task->notify_count;
+    if (count > 0) {
+        task->notify_count = clear_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return count;
+}
+
+static struct host_queue *queue_alloc(UBaseType_t length, UBaseType_t item_size, UBaseType_t count)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (queue == NULL)
+        return NULL;
+
+    if (item_size > 0) {
+        queue->items = malloc(length * item_size);
+        if (queue->items == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->count = count;
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->changed);
+
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return queue_alloc(length, item_size, 0);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue == NULL)
+        return;
+
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+static bool queue_has_room(void *arg)
+{
+    struct host_queue *queue = arg;
+    return queue->count < queue->length;
+}
+
+static bool queue_has_items(void *arg)
+{
+    return ((struct host_queue *) arg)->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    if (!wait_until(&queue->changed, &queue->lock, ticks, queue_has_room, queue)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFALSE;
+    }
+
+    if (queue->item_size > 0) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    if (!wait_until(&queue->changed, &queue->lock, ticks, queue_has_items, queue)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFALSE;
+    }
+
+    if (queue->item_size > 0) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+    }
+    queue->count--;
+
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_alloc(1, 0, 0);
+}
+
+/* created given, like in FreeRTOS */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return queue_alloc(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return queue_alloc(max_count, 0, initial_count);
+}
@@ -0,0 +1,90 @@
+/*
+ * spi_master_host.c
+ *
+ * SPI master with a 23LC1024 serial SRAM as the only device, enough for
+ * spiram.c: sequential READ and WRITE with a 24 bit address, WRMR is
+ * accepted and ignored. Transfers longer than the controller could do fail
+ * like they would on the ESP32, 64 bytes without DMA.
+ *
+ *  Created on: 13.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <string.h>
+
+#include "driver/spi_master.h"
+
+#define CHIP_SIZE (128 * 1024)
+
+#define CMD_READ    0x03
+#define CMD_WRITE   0x02
+#define CMD_WRMR    0x01
+
+/* what the controller buffers itself */
+#define NO_DMA_MAX_TRANSFER 64
+
+struct spi_device {
+    char mem[CHIP_SIZE];
+};
+
+static struct spi_device chip;
+static int max_transfer = NO_DMA_MAX_TRANSFER;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *bus_config, int dma_chan)
+{
+    if (dma_chan != 0 && bus_config->max_transfer_sz > 0) {
+        max_transfer = bus_config->max_transfer_sz;
+    }
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *dev_config,
+        spi_device_handle_t *handle)
+{
+    *handle = &chip;
+    return ESP_OK;
+}
+
+/* sequential mode, the address wraps at the end of the chip */
+static void chip_read(uint32_t addr, char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = chip.mem[(addr + i) % CHIP_SIZE];
+    }
+}
+
+static void chip_write(uint32_t addr, const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        chip.mem[(addr + i) % CHIP_SIZE] = buf[i];
+    }
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    size_t tx_len = trans_desc->length / 8;
+    size_t rx_len = trans_desc->rxlength / 8;
+    uint32_t addr = trans_desc->addr & 0xffffff;
+
+    if (tx_len > max_transfer || rx_len > max_transfer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    switch (trans_desc->cmd) {
+        case CMD_READ:
+            chip_read(addr, trans_desc->rx_buffer, rx_len);
+            break;
+
+        case CMD_WRITE:
+            chip_write(addr, trans_desc->tx_buffer, tx_len);
+            break;
+
+        case CMD_WRMR:
+            break;
+
+        default:
+            return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
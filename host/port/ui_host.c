@@ -0,0 +1,17 @@
+/*
+ * ui_host.c
+ *
+ * No LEDs on the host.
+ *
+ *  Created on: 12.07.2017
+ *      Author: michaelboeckling
+ */
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "ui.h"
+
+void ui_queue_event(ui_event_t evt)
+{
+}
@@ -19,8 +19,9 @@
 #include "driver/i2s.h"
 
 #include "ui.h"
-#include "spiram_fifo.h"
+#include "fifo.h"
 #include "audio_renderer.h"
+#include "renderer_sink.h"
 #include "audio_recorder.h"
 #include "web_radio.h"
 #include "playerconfig.h"
@@ -31,6 +32,11 @@
 #ifdef CONFIG_BT_SPEAKER_MODE
 #include "bt_speaker.h"
 #endif
+#ifdef CONFIG_AUDIO_SINK_WAV
+#include "esp_vfs_fat.h"
+#include "driver/sdmmc_host.h"
+#include "sdmmc_cmd.h"
+#endif
 
 
 #define WIFI_LIST_NUM   10
@@ -44,6 +50,9 @@
 #define PRIO_MQTT configMAX_PRIORITIES - 3
 #define PRIO_CONNECT configMAX_PRIORITIES -1
 
+/* where the WAV sink finds its file system */
+#define SDCARD_MOUNT_POINT "/sdcard"
+
 
 
 static void alexa_task(void *pvParameters)
@@ -57,16 +66,46 @@ static void alexa_task(void *pvParameters)
 }
 
 
+#ifdef CONFIG_AUDIO_SINK_WAV
+/* 1-line mode, the other data lines are strapping pins */
+static void mount_sdcard()
+{
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    host.flags = SDMMC_HOST_FLAG_1BIT;
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = 2
+    };
+
+    sdmmc_card_t *card;
+    esp_err_t err = esp_vfs_fat_sdmmc_mount(SDCARD_MOUNT_POINT, &host, &slot_config,
+            &mount_config, &card);
+    if (err != ESP_OK) {
+        // the renderer can't create its file then and stops the boot
+        ESP_LOGE(TAG, "can't mount the SD card at %s: %d", SDCARD_MOUNT_POINT, err);
+        return;
+    }
+
+    ESP_LOGI(TAG, "SD card mounted at %s", SDCARD_MOUNT_POINT);
+}
+#endif
+
 static void init_hardware()
 {
     nvs_flash_init();
 
+#ifdef CONFIG_AUDIO_SINK_WAV
+    mount_sdcard();
+#endif
+
     // init UI
     // ui_init(GPIO_NUM_32);
 
     //Initialize the SPI RAM chip communications and see if it actually retains some bytes. If it
     //doesn't, warn user.
-    if (!spiRamFifoInit()) {
+    if (!fifo_init()) {
         printf("\n\nSPI RAM chip fail!\n");
         while(1);
     }
@@ -100,7 +139,9 @@ static renderer_config_t *create_renderer_config()
     renderer_config->i2s_num = I2S_NUM_0;
     renderer_config->sample_rate = 44100;
     renderer_config->sample_rate_modifier = 1.0;
+    renderer_config->output_sample_rate = AUDIO_OUTPUT_SAMPLE_RATE;
     renderer_config->output_mode = AUDIO_OUTPUT_MODE;
+    renderer_config->latency = LATENCY_NORMAL;
 
     if(renderer_config->output_mode == I2S_MERUS) {
         renderer_config->bit_depth = I2S_BITS_PER_SAMPLE_32BIT;
@@ -110,6 +151,15 @@ static renderer_config_t *create_renderer_config()
         renderer_config->bit_depth = I2S_BITS_PER_SAMPLE_16BIT;
     }
 
+#if defined(CONFIG_AUDIO_SINK_WAV)
+    renderer_config->sink = &renderer_sink_wav;
+    renderer_config->sink_path = CONFIG_AUDIO_SINK_WAV_PATH;
+#elif defined(CONFIG_AUDIO_SINK_NULL)
+    renderer_config->sink = &renderer_sink_null;
+#else
+    renderer_config->sink = &renderer_sink_i2s;
+#endif
+
     return renderer_config;
 }
 
@@ -126,9 +176,12 @@ static void start_web_radio()
     radio_config->player_config->decoder_command = CMD_NONE;
     radio_config->player_config->buffer_pref = BUF_PREF_SAFE;
     radio_config->player_config->media_stream = calloc(1, sizeof(media_stream_t));
+    radio_config->player_config->fifo = fifo_create(PLAYER_FIFO_SIZE, FIFO_BACKING_SPIRAM);
 
-    // init renderer
-    renderer_init(create_renderer_config());
+    // init renderer, radio doesn't care about latency but hates dropouts
+    renderer_config_t *renderer_config = create_renderer_config();
+    renderer_config->latency = LATENCY_DEEP;
+    renderer_init(renderer_config);
 
     // start radio
     web_radio_init(radio_config);
@@ -177,7 +230,9 @@ void app_main()
     init_hardware();
 
 #ifdef CONFIG_BT_SPEAKER_MODE
-    bt_speaker_start(create_renderer_config());
+    renderer_config_t *renderer_config = create_renderer_config();
+    renderer_config->latency = LATENCY_DEEP;
+    bt_speaker_start(renderer_config);
 #else
 
     /*
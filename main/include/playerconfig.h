@@ -34,6 +34,7 @@
 
 // defined via 'make menuconfig'
 #define AUDIO_OUTPUT_MODE CONFIG_AUDIO_OUTPUT_MODE
+#define AUDIO_OUTPUT_SAMPLE_RATE CONFIG_AUDIO_OUTPUT_SAMPLE_RATE
 
 #define FAKE_SPI_BUFF
 